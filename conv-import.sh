@@ -5,6 +5,16 @@ CONVERT_BINARY=${TOOLS_PATH}/convert/build/convert
 DB_SCHEME=${TOOLS_PATH}/queries/db-scheme.sql
 CONV_OUTPUT=conv-out.txt
 PROCESS_CONTEXT=${PROCESS_CONTEXT:-0}
+# LOCKSETS=1 stores each distinct set of held locks once (locksets table) instead of the locks_held table.
+# LOCKSETS=2 additionally fills locks_held, e.g., for the acquisition timestamps.
+LOCKSETS=${LOCKSETS:-0}
+# BINARY_COPY=1 lets convert write PostgreSQL's binary COPY format, which the database does not have to parse.
+BINARY_COPY=${BINARY_COPY:-0}
+# OUTPUT_COMPRESSION=gzip or zstd lets convert compress its output files in the background, e.g., to keep them with --nodb.
+# They can be imported later on with COPY ... FROM PROGRAM 'zcat ...' or 'zstdcat ...'.
+OUTPUT_COMPRESSION=${OUTPUT_COMPRESSION:-}
+# ACCESS_SHARDS=n splits the accesses into n files by their alloc_id, which are copied into the database in parallel.
+ACCESS_SHARDS=${ACCESS_SHARDS:-1}
 # The config file must contain two variable definitions: (1) DATA which describes the path to the input data, and (2) KERNEL the path to the kernel image
 
 if [ ! -f ${CONFIGFILE} ];
@@ -56,6 +66,34 @@ then
 	CTX_PROCESSING="-c"
 fi
 
+if [ ${LOCKSETS} -gt 0 ];
+then
+	echo "Enabling lock sets..."
+	LOCKSET_PROCESSING="-l"
+	if [ ${LOCKSETS} -gt 1 ];
+	then
+		LOCKSET_PROCESSING="-l -p"
+	fi
+fi
+
+if [ ${BINARY_COPY} -gt 0 ];
+then
+	echo "Enabling binary COPY format..."
+	FORMAT_PROCESSING="-f"
+fi
+
+if [ -n "${OUTPUT_COMPRESSION}" ];
+then
+	echo "Enabling ${OUTPUT_COMPRESSION} compression of the output files..."
+	FORMAT_PROCESSING="${FORMAT_PROCESSING} -z ${OUTPUT_COMPRESSION}"
+fi
+
+if [ ${ACCESS_SHARDS} -gt 1 ];
+then
+	echo "Splitting the accesses into ${ACCESS_SHARDS} files..."
+	FORMAT_PROCESSING="${FORMAT_PROCESSING} -n ${ACCESS_SHARDS}"
+fi
+
 if [ -z ${PSQL_USER} ] || [ -z ${PSQL_HOST} ];
 then
 	echo "Vars PSQL_USER or PSQL_HOST are not set!" >&2
@@ -100,22 +138,65 @@ else
 	shift
 fi
 
-TABLES=("data_types" "allocations" "accesses" "locks" "locks_held" "structs_layout" "txns" "function_blacklist" "member_names" "member_blacklist" "stacktraces" "subclasses")
+# Each shard of the accesses, e.g., accesses.0, is imported into the accesses table.
+ACCESS_TABLES=("accesses")
+if [ ${ACCESS_SHARDS} -gt 1 ]; then
+	ACCESS_TABLES=()
+	for ((i = 0; i < ${ACCESS_SHARDS}; i++)); do
+		ACCESS_TABLES+=("accesses.${i}")
+	done
+fi
+TABLES=("data_types" "allocations" "${ACCESS_TABLES[@]}" "locks" "structs_layout" "txns" "function_blacklist" "member_names" "member_blacklist" "stacktraces" "subclasses")
+if [ ${LOCKSETS} -gt 0 ]; then
+	TABLES+=("locksets")
+fi
+if [ ${LOCKSETS} -ne 1 ]; then
+	TABLES+=("locks_held")
+fi
 PSQL="psql --quiet --echo-errors -h ${PSQL_HOST} -U ${PSQL_USER} ${DB}"
 PSQLIMPORT="psqlimport_warnings"
 
+# structs_layout is always written as CSV
+function table_file() {
+	if [ ${BINARY_COPY} -gt 0 ] && [ ${1} != structs_layout ]; then
+		echo ${1}.pgcopy
+	else
+		echo ${1}.csv
+	fi
+}
+
+# The file convert writes a table to. structs_layout is never compressed.
+function output_file() {
+	FILE=$(table_file ${1})
+	if [ ${1} != structs_layout ]; then
+		case ${OUTPUT_COMPRESSION} in
+			gzip) FILE=${FILE}.gz ;;
+			zstd) FILE=${FILE}.zst ;;
+		esac
+	fi
+	echo ${FILE}
+}
+
 function psqlimport_warnings() {
-	TABLE=${1%%.csv.pv}
-	${PSQL} -c "\COPY ${TABLE} FROM '$1' WITH (FORMAT csv, header true, delimiter '$DELIMITER', NULL '\N');"
+	TABLE=${1%%.*}
+	if [[ ${1} = *.pgcopy.pv ]]; then
+		${PSQL} -c "\COPY ${TABLE} FROM '$1' WITH (FORMAT binary);"
+	else
+		${PSQL} -c "\COPY ${TABLE} FROM '$1' WITH (FORMAT csv, header true, delimiter '$DELIMITER', NULL '\N');"
+	fi
 }
 
 function import_table() {
-	if [ ! -e ${1}.csv ];
+	FILE=$(table_file ${1})
+	if [ ! -e $(output_file ${1}) ];
 	then
-		echo "${1}.csv does not exist." >&2
+		echo "$(output_file ${1}) does not exist." >&2
 	else
-		echo "DELETE FROM ${1}" | ${PSQL}
-		${PSQLIMPORT} ${1}.csv.pv
+		# The shards of a table are imported concurrently. Hence, none of them may empty it.
+		if [ ${1} = ${1%%.*} ]; then
+			echo "DELETE FROM ${1}" | ${PSQL}
+		fi
+		${PSQLIMPORT} ${FILE}.pv
 	fi
 }
 
@@ -141,16 +222,38 @@ if [ $USE_DB = true ]; then
 		echo "Cannot apply db scheme!">&2
 		exit 1
 	fi
+	if [ ${LOCKSETS} -gt 0 ];
+	then
+		${PSQL} < ${TOOLS_PATH}/queries/db-scheme-locksets.sql
+		if [ ${?} -ne 0 ];
+		then
+			echo "Cannot apply lock set db scheme!">&2
+			exit 1
+		fi
+	fi
+
+	if [ ${ACCESS_SHARDS} -gt 1 ];
+	then
+		# Concurrent COPYs would contend for the indexes. They are built once all shards have been imported.
+		echo "ALTER TABLE accesses DROP CONSTRAINT accesses_pkey; DROP INDEX fk_alloc_id;" | ${PSQL}
+	fi
 
 	echo "Setting up fifos..."
 	# setup named pipes and start importing in the background
 	for table in "${TABLES[@]}"
 	do
-		rm -f ${table}.csv ${table}.csv.pv
-		mkfifo ${table}.csv ${table}.csv.pv
+		file=$(table_file ${table})
+		ofile=$(output_file ${table})
+		rm -f ${ofile} ${file}.pv
+		mkfifo ${ofile} ${file}.pv
 		if [ $table = accesses ]; then BUFSIZE=100m; else BUFSIZE=10m; fi
-		#pv --buffer-size $BUFSIZE -c -r -a -b -T -l -N ${table} < ${table}.csv > ${table}.csv.pv &
-		cat < ${table}.csv > ${table}.csv.pv &
+		#pv --buffer-size $BUFSIZE -c -r -a -b -T -l -N ${table} < ${ofile} > ${file}.pv &
+		# The compressed blocks form a valid stream, which is decompressed on its way to the database.
+		case ${ofile} in
+			*.gz) gzip -dc < ${ofile} > ${file}.pv & ;;
+			*.zst) zstd -dcq < ${ofile} > ${file}.pv & ;;
+			*) cat < ${ofile} > ${file}.pv & ;;
+		esac
 		import_table ${table} &
 	done
 fi
@@ -159,11 +262,11 @@ fi
 #GDB='cgdb --args'
 
 if echo $DATA | egrep -q '.bz2$'; then
-	$VALGRIND $GDB ${CONVERT_BINARY} ${CTX_PROCESSING} -g ${KERNEL_TREE} -t ${DATA_TYPES} -k $KERNEL -b ${FN_BLACK_LIST} -m ${MEMBER_BLACK_LIST} -d "${DELIMITER}" <( eval pbzip2 -d < $DATA ${HEAD_CMD} ) > ${CONV_OUTPUT} 2>&1
+	$VALGRIND $GDB ${CONVERT_BINARY} ${CTX_PROCESSING} ${LOCKSET_PROCESSING} ${FORMAT_PROCESSING} -g ${KERNEL_TREE} -t ${DATA_TYPES} -k $KERNEL -b ${FN_BLACK_LIST} -m ${MEMBER_BLACK_LIST} -d "${DELIMITER}" <( eval pbzip2 -d < $DATA ${HEAD_CMD} ) > ${CONV_OUTPUT} 2>&1
 elif echo $DATA | egrep -q '.gz$'; then
-	$VALGRIND $GDB ${CONVERT_BINARY} ${CTX_PROCESSING} -g ${KERNEL_TREE} -t ${DATA_TYPES} -k $KERNEL -b ${FN_BLACK_LIST} -m ${MEMBER_BLACK_LIST} -d "${DELIMITER}" <( eval gzip -d < $DATA ${HEAD_CMD} ) > ${CONV_OUTPUT} 2>&1
+	$VALGRIND $GDB ${CONVERT_BINARY} ${CTX_PROCESSING} ${LOCKSET_PROCESSING} ${FORMAT_PROCESSING} -g ${KERNEL_TREE} -t ${DATA_TYPES} -k $KERNEL -b ${FN_BLACK_LIST} -m ${MEMBER_BLACK_LIST} -d "${DELIMITER}" <( eval gzip -d < $DATA ${HEAD_CMD} ) > ${CONV_OUTPUT} 2>&1
 elif echo $DATA | egrep -q '.csv$'; then
-	$VALGRIND $GDB ${CONVERT_BINARY} ${CTX_PROCESSING} -g ${KERNEL_TREE} -t ${DATA_TYPES} -k $KERNEL -b ${FN_BLACK_LIST} -m ${MEMBER_BLACK_LIST} -d "${DELIMITER}" <( eval cat $DATA ${HEAD_CMD} ) > ${CONV_OUTPUT} 2>&1
+	$VALGRIND $GDB ${CONVERT_BINARY} ${CTX_PROCESSING} ${LOCKSET_PROCESSING} ${FORMAT_PROCESSING} -g ${KERNEL_TREE} -t ${DATA_TYPES} -k $KERNEL -b ${FN_BLACK_LIST} -m ${MEMBER_BLACK_LIST} -d "${DELIMITER}" <( eval cat $DATA ${HEAD_CMD} ) > ${CONV_OUTPUT} 2>&1
 else
 	echo "no idea what to do with filename extension of $DATA" >&2
 	exit 1
@@ -173,8 +276,15 @@ if [ $USE_DB = true ]; then
 	wait
 	#reset
 
+	if [ ${ACCESS_SHARDS} -gt 1 ];
+	then
+		echo "Indexing accesses..."
+		echo "ALTER TABLE accesses ADD PRIMARY KEY (id); CREATE INDEX fk_alloc_id ON accesses (alloc_id, address);" | ${PSQL}
+	fi
+
 	for table in "${TABLES[@]}"
 	do
-		rm -f ${table}.csv ${table}.csv.pv
+		file=$(table_file ${table})
+		rm -f $(output_file ${table}) ${file}.pv
 	done
 fi
@@ -62,11 +62,15 @@ gzstreambuf* gzstreambuf::open( const char* name, int open_mode) {
     if (file == 0)
         return (gzstreambuf*)0;
     opened = 1;
+    if ( mode & std::ios::in)
+        startProducer();
     return this;
 }
 
 gzstreambuf * gzstreambuf::close() {
     if ( is_open()) {
+        if ( mode & std::ios::in)
+            stopProducerThread();
         sync();
         opened = 0;
         if ( gzclose( file) == Z_OK)
@@ -75,26 +79,106 @@ gzstreambuf * gzstreambuf::close() {
     return (gzstreambuf*)0;
 }
 
+void gzstreambuf::startProducer() {
+    // A larger input buffer lets zlib read the compressed file in big chunks.
+    gzbuffer( file, gzBufferSize);
+    for ( int i = 0; i < readBlockCount; i++)
+        readBlocks[i] = new char[putbackSize + readBlockSize];
+    filledBlocks = producerIdx = consumerIdx = 0;
+    holdingBlock = producerDone = readFailed = stopProducer = false;
+    readError.clear();
+    setg( buffer + 4, buffer + 4, buffer + 4);
+    producer = std::thread( &gzstreambuf::produceBlocks, this);
+}
+
+void gzstreambuf::stopProducerThread() {
+    {
+        std::lock_guard<std::mutex> guard( ringLock);
+        stopProducer = true;
+    }
+    blockFreed.notify_one();
+    if ( producer.joinable())
+        producer.join();
+    for ( int i = 0; i < readBlockCount; i++) {
+        delete[] readBlocks[i];
+        readBlocks[i] = 0;
+    }
+    setg( buffer + 4, buffer + 4, buffer + 4);
+}
+
+void gzstreambuf::produceBlocks() {
+    for (;;) {
+        {
+            // Wait for a free block. The one held by the reader counts as filled.
+            std::unique_lock<std::mutex> guard( ringLock);
+            blockFreed.wait( guard, [this] {
+                return filledBlocks < readBlockCount || stopProducer; });
+            if ( stopProducer)
+                break;
+        }
+        // The block at producerIdx belongs to this thread until it is published.
+        int num = gzread( file, readBlocks[producerIdx] + putbackSize, readBlockSize);
+        std::lock_guard<std::mutex> guard( ringLock);
+        if ( num <= 0) { // ERROR or EOF
+            // A truncated file ends like a complete one, but leaves Z_BUF_ERROR.
+            int errnum;
+            const char *msg = gzerror( file, &errnum);
+            if ( num < 0 || errnum != Z_OK) {
+                readFailed = true;
+                readError = msg;
+            }
+            break;
+        }
+        readBlockLen[producerIdx] = num;
+        producerIdx = (producerIdx + 1) % readBlockCount;
+        filledBlocks++;
+        blockFilled.notify_one();
+    }
+    std::lock_guard<std::mutex> guard( ringLock);
+    producerDone = true;
+    blockFilled.notify_one();
+}
+
 int gzstreambuf::underflow() { // used for input buffer only
     if ( gptr() && ( gptr() < egptr()))
         return * reinterpret_cast<unsigned char *>( gptr());
 
     if ( ! (mode & std::ios::in) || ! opened)
         return EOF;
-    // Josuttis' implementation of inbuf
+    // Josuttis' implementation of inbuf. The putback area has to be saved
+    // before the current block is handed back to the producer.
+    char putback[putbackSize];
     int n_putback = gptr() - eback();
-    if ( n_putback > 4)
-        n_putback = 4;
-    memcpy( buffer + (4 - n_putback), gptr() - n_putback, n_putback);
-
-    int num = gzread( file, buffer+4, bufferSize-4);
-    if (num <= 0) // ERROR or EOF
-        return EOF;
+    if ( n_putback > putbackSize)
+        n_putback = putbackSize;
+    memcpy( putback, gptr() - n_putback, n_putback);
+
+    char *block;
+    int num;
+    {
+        std::unique_lock<std::mutex> guard( ringLock);
+        if ( holdingBlock) {
+            holdingBlock = false;
+            consumerIdx = (consumerIdx + 1) % readBlockCount;
+            filledBlocks--;
+            blockFreed.notify_one();
+        }
+        blockFilled.wait( guard, [this] {
+            return filledBlocks > 0 || producerDone; });
+        if ( filledBlocks == 0) { // ERROR or EOF
+            setg( buffer + 4, buffer + 4, buffer + 4);
+            return EOF;
+        }
+        holdingBlock = true;
+        block = readBlocks[consumerIdx];
+        num = readBlockLen[consumerIdx];
+    }
+    memcpy( block + (putbackSize - n_putback), putback, n_putback);
 
     // reset buffer pointers
-    setg( buffer + (4 - n_putback),   // beginning of putback area
-          buffer + 4,                 // read position
-          buffer + 4 + num);          // end of buffer
+    setg( block + (putbackSize - n_putback),   // beginning of putback area
+          block + putbackSize,                 // read position
+          block + putbackSize + num);          // end of buffer
 
     // return next character
     return * reinterpret_cast<unsigned char *>( gptr());    
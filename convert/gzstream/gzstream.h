@@ -32,6 +32,9 @@
 // standard C++ with new header file names and std:: namespace
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <zlib.h>
 
 #ifdef GZSTREAM_NAMESPACE
@@ -52,9 +55,39 @@ private:
     char             opened;             // open/close state of stream
     int              mode;               // I/O mode
 
+    // Input is decompressed by a dedicated thread into a ring of large
+    // blocks, which underflow() hands out one after the other. Thus,
+    // inflating the file overlaps with processing its contents.
+    static const int readBlockSize  = 4 << 20; // decompressed bytes per block
+    static const int readBlockCount = 4;       // number of blocks in the ring
+    static const int putbackSize    = 4;       // reserved in front of each block
+    static const unsigned gzBufferSize = 1 << 20; // zlib's internal input buffer
+
+    char*            readBlocks[readBlockCount]; // putbackSize + readBlockSize each
+    int              readBlockLen[readBlockCount]; // valid bytes per block
+    int              filledBlocks;       // blocks ready or held by the reader
+    int              producerIdx;        // block the thread fills next
+    int              consumerIdx;        // block the reader holds or takes next
+    bool             holdingBlock;       // reader currently uses consumerIdx
+    bool             producerDone;       // EOF or error reached by the thread
+    bool             readFailed;         // gzread() failed, e.g., on a truncated file
+    std::string      readError;          // gzerror() of the failed gzread()
+    bool             stopProducer;       // close() asks the thread to quit
+    std::thread      producer;
+    std::mutex       ringLock;
+    std::condition_variable blockFilled;
+    std::condition_variable blockFreed;
+
     int flush_buffer();
+    void startProducer();
+    void stopProducerThread();
+    void produceBlocks();
 public:
-    gzstreambuf() : opened(0) {
+    gzstreambuf() : opened(0), filledBlocks(0), producerIdx(0), consumerIdx(0),
+                    holdingBlock(false), producerDone(false), readFailed(false),
+                    stopProducer(false) {
+        for ( int i = 0; i < readBlockCount; i++)
+            readBlocks[i] = 0;
         setp( buffer, buffer + (bufferSize-1));
         setg( buffer + 4,     // beginning of putback area
               buffer + 4,     // read position
@@ -62,6 +95,9 @@ public:
         // ASSERT: both input & output capabilities will not be used together
     }
     bool is_open() { return opened; }
+    // Valid once underflow() has returned EOF
+    bool read_failed() const { return readFailed; }
+    const char* read_error() const { return readError.c_str(); }
     gzstreambuf* open( const char* name, int open_mode);
     gzstreambuf* close();
     ~gzstreambuf() { close(); }
@@ -99,6 +135,9 @@ public:
     void open( const char* name, int open_mode = std::ios::in) {
         gzstreambase::open( name, open_mode);
     }
+    // Tells an EOF caused by a corrupt or truncated file from a real one
+    bool read_failed() const { return buf.read_failed(); }
+    const char* read_error() const { return buf.read_error(); }
 };
 
 class ogzstream : public gzstreambase, public std::ostream {
@@ -0,0 +1,216 @@
+#ifndef __ADDRESSINDEX_H__
+#define __ADDRESSINDEX_H__
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#define ADDRESS_INDEX_MIN_BITS		10				// log2 of the initial number of slots
+#define ADDRESS_INDEX_MAX_LOAD		70				// Percentage of used slots that triggers growing the table
+#define ADDRESS_INDEX_BLOCK			256				// Start addresses in a full block of the ordered index
+
+/**
+ * Maps the start address of a memory area, e.g., an allocation, to a {@param T}.
+ * Exact lookups, which are by far the most frequent ones, hit a flat, open-addressing hash table.
+ * The slot of the last hit is remembered, because consecutive events mostly refer to the same area.
+ * The start addresses are also kept in ascending order, in sorted blocks of at most ADDRESS_INDEX_BLOCK entries,
+ * like the leaves of a B-tree with a single, flat inner node. They answer which area precedes a given address,
+ * and allow for visiting the areas in address order. Unlike a node-based tree, an insert or erase
+ * only moves a few contiguous entries, and a lookup does two binary searches over contiguous memory.
+ * A pointer handed out stays valid until the next insert() or erase().
+ */
+template <typename T>
+struct AddressIndex {
+	AddressIndex() : m_used(0), m_bits(ADDRESS_INDEX_MIN_BITS), m_last(0) {
+		m_slots.resize(1UL << m_bits);
+	}
+
+	size_t size() const {
+		return m_used;
+	}
+
+	/**
+	 * Returns the element starting at {@param address}, or NULL.
+	 */
+	T* find(uint64_t address) {
+		Slot &last = m_slots[m_last];
+		if (last.used && last.address == address) {
+			return &last.value;
+		}
+		for (size_t idx = slotOf(address);; idx = (idx + 1) & mask()) {
+			Slot &slot = m_slots[idx];
+			if (!slot.used) {
+				return NULL;
+			}
+			if (slot.address == address) {
+				m_last = idx;
+				return &slot.value;
+			}
+		}
+	}
+
+	/**
+	 * Inserts a default-constructed element starting at {@param address}.
+	 * Returns NULL if there already is one.
+	 */
+	T* insert(uint64_t address) {
+		if (find(address)) {
+			return NULL;
+		}
+		if ((m_used + 1) * 100 > m_slots.size() * ADDRESS_INDEX_MAX_LOAD) {
+			grow();
+		}
+		size_t idx = slotOf(address);
+		while (m_slots[idx].used) {
+			idx = (idx + 1) & mask();
+		}
+		Slot &slot = m_slots[idx];
+		slot.used = true;
+		slot.address = address;
+		slot.value = T();
+		m_used++;
+		insertOrdered(address);
+		m_last = idx;
+		return &slot.value;
+	}
+
+	/**
+	 * Removes the element starting at {@param address}.
+	 * Returns false if there is none.
+	 */
+	bool erase(uint64_t address) {
+		if (!find(address)) {
+			return false;
+		}
+		// find() has left the slot in m_last. Shift the following elements of the cluster back,
+		// so that lookups never have to skip deleted slots.
+		size_t hole = m_last, idx = m_last;
+		while (1) {
+			idx = (idx + 1) & mask();
+			Slot &slot = m_slots[idx];
+			if (!slot.used) {
+				break;
+			}
+			size_t home = slotOf(slot.address);
+			// Move the element if its home slot does not lie cyclically within (hole, idx].
+			if (((idx - home) & mask()) >= ((idx - hole) & mask())) {
+				m_slots[hole] = slot;
+				hole = idx;
+			}
+		}
+		m_slots[hole].used = false;
+		m_used--;
+		eraseOrdered(address);
+		return true;
+	}
+
+	/**
+	 * Returns the element with the highest start address less than or equal to {@param address}, or NULL.
+	 * Its start address is stored in {@param start}.
+	 */
+	T* findPreceding(uint64_t address, uint64_t &start) {
+		auto itBlock = std::upper_bound(m_firsts.begin(), m_firsts.end(), address);
+		if (itBlock == m_firsts.begin()) {
+			return NULL;
+		}
+		// The block's first start address is not greater than address.
+		const std::vector<uint64_t> &block = m_blocks[itBlock - m_firsts.begin() - 1];
+		start = *(std::upper_bound(block.begin(), block.end(), address) - 1);
+		return find(start);
+	}
+
+	/**
+	 * Calls {@param fn} with the start address and the element for every element in address order.
+	 */
+	template <typename Fn>
+	void forEach(Fn fn) {
+		for (const auto &block : m_blocks) {
+			for (uint64_t address : block) {
+				fn(address, *find(address));
+			}
+		}
+	}
+
+	private:
+	struct Slot {
+		Slot() : used(false), address(0) { }
+		bool used;
+		uint64_t address;
+		T value;
+	};
+
+	std::vector<Slot> m_slots;									// The hash table, its size is a power of two
+	size_t m_used;												// Number of used slots
+	unsigned m_bits;											// log2 of m_slots.size()
+	size_t m_last;												// Slot of the last hit
+	std::vector<std::vector<uint64_t>> m_blocks;				// All start addresses in ascending order, none of the blocks is empty
+	std::vector<uint64_t> m_firsts;								// First start address of each block
+
+	size_t mask() const {
+		return m_slots.size() - 1;
+	}
+
+	size_t slotOf(uint64_t address) const {
+		// Fibonacci hashing spreads the aligned addresses evenly across the table.
+		return (address * 0x9E3779B97F4A7C15ULL) >> (64 - m_bits);
+	}
+
+	/**
+	 * Returns the block {@param address} belongs into.
+	 */
+	size_t blockOf(uint64_t address) const {
+		auto it = std::upper_bound(m_firsts.begin(), m_firsts.end(), address);
+		return it == m_firsts.begin() ? 0 : it - m_firsts.begin() - 1;
+	}
+
+	void insertOrdered(uint64_t address) {
+		if (m_blocks.empty()) {
+			m_blocks.emplace_back(1, address);
+			m_firsts.push_back(address);
+			return;
+		}
+		size_t idx = blockOf(address);
+		std::vector<uint64_t> &block = m_blocks[idx];
+		block.insert(std::upper_bound(block.begin(), block.end(), address), address);
+		m_firsts[idx] = block.front();
+		if (block.size() >= ADDRESS_INDEX_BLOCK) {
+			// Split the full block in halves
+			std::vector<uint64_t> upper(block.begin() + block.size() / 2, block.end());
+			block.resize(block.size() / 2);
+			m_firsts.insert(m_firsts.begin() + idx + 1, upper.front());
+			m_blocks.insert(m_blocks.begin() + idx + 1, std::move(upper));
+		}
+	}
+
+	void eraseOrdered(uint64_t address) {
+		size_t idx = blockOf(address);
+		std::vector<uint64_t> &block = m_blocks[idx];
+		block.erase(std::lower_bound(block.begin(), block.end(), address));
+		if (block.empty()) {
+			m_blocks.erase(m_blocks.begin() + idx);
+			m_firsts.erase(m_firsts.begin() + idx);
+		} else {
+			m_firsts[idx] = block.front();
+		}
+	}
+
+	void grow() {
+		std::vector<Slot> old;
+		old.swap(m_slots);
+		m_bits++;
+		m_slots.resize(1UL << m_bits);
+		for (const Slot &slot : old) {
+			if (!slot.used) {
+				continue;
+			}
+			size_t idx = slotOf(slot.address);
+			while (m_slots[idx].used) {
+				idx = (idx + 1) & mask();
+			}
+			m_slots[idx] = slot;
+		}
+		m_last = 0;
+	}
+};
+
+#endif // __ADDRESSINDEX_H__
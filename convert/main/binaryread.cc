@@ -3,10 +3,18 @@
 #include <iostream>
 #include <bfd.h>
 #include <cstring>
+#include <algorithm>
+#include <climits>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include "binaryread.h"
 #include "config.h"
 #include "dwarves_api.h"
+#include "lineindex.h"
+#include "symbolcache.h"
 
 using namespace std;
 
@@ -14,6 +22,7 @@ using namespace std;
  * Passes context information to find_address_in_section
  * which resolves a instruction pointer to a code location.
  * @pc: The instruction pointer
+ * @syms: Symbol table of the bfd being searched
  * @found: Indicates that the locations has already been found.
  * @file: Source file
  * @fn: Function name
@@ -21,6 +30,7 @@ using namespace std;
  */
 struct BfdSearchCtx {
 	bfd_vma pc;
+	asymbol **syms;
 	bfd_boolean found;
 	const char *file;
 	const char *fn;
@@ -32,18 +42,24 @@ struct BfdSearchCtx {
  */
 struct CusIterArgs {
 	std::vector<DataType> *types = nullptr;
+	size_t missingTypes = 0;									// Datatypes not found in the dwarf information yet
 	expand_type_fn expand_type;
 	add_member_name_fn add_member_name;
 	FILE *fp = nullptr;
 };
 /**
- * Passes context information to the findGlobalLockVar function
- * @addr: Address of the lock variable we want to resolve
- * @lockVarname: The variable the lock with @addr resides in
+ * A global variable definition found in the dwarf information
+ * @start, @end: The address range [start, end) it occupies
+ * @name: Its name
+ * @order: The position of the definition in the walk over all compilation units
+ * @maxEnd: The highest end of all variables starting at or below @start
  */
-struct lockVarSearch {
-	uint64_t addr;
-	const char* lockVarName;
+struct GlobalVar {
+	uint64_t start;
+	uint64_t end;
+	const char *name;
+	unsigned order;
+	uint64_t maxEnd;
 };
 
 /**
@@ -62,6 +78,24 @@ static map<uint64_t, const char*> addrToSym;
  * address -> code location cache
  */
 static std::map<uint64_t, ResolvedInstructionPtr> functionAddresses;
+/**
+ * Resolves instruction pointers without libbfd, if built.
+ * It is built on the first instruction pointer missing from functionAddresses, because a warm symbol cache may answer all of them.
+ */
+static LineIndex lineIndex;
+static bool lineIndexUsed;										// binaryread_init() has been asked to use the index
+static string lineIndexVmlinux;									// Empty unless the index is yet to be built
+/**
+ * Persists functionAddresses across runs, if loaded
+ */
+static SymbolCache symbolCache;
+/**
+ * All global variable definitions sorted by address, built on the first call of getGlobalLockVar()
+ */
+static vector<GlobalVar> globalVars;
+static bool globalVarsBuilt;
+static unsigned long long globalVarLookups;
+static chrono::nanoseconds globalVarLookupTime;
 /**
  * A dwarves descriptor for the vmlinux
  */
@@ -70,11 +104,17 @@ static struct cus *kernelCUs;
  * A bfd descriptor for the vmlinux
  */
 static bfd *kernelBfd;
+/**
+ * Serializes the lookups of resolve_addrs()' workers in kernelBfd.
+ * libbfd before 2.42 shares a file descriptor cache across all bfds, and reads the DWARF sections lazily.
+ * Hence, not even lookups in separate bfds are thread-safe.
+ */
+static mutex kernelBfdLock;
 
-static int findGlobalLockVar(struct cu *cu, void *cookie) {
+static int collectGlobalVars(struct cu *cu, void *cookie) {
 	uint32_t i;
 	struct tag *pos;
-	struct lockVarSearch *lockVar = (struct lockVarSearch*)cookie;
+	vector<GlobalVar> *globalVars = (vector<GlobalVar>*)cookie;
 
 	cu__for_each_variable(cu, i, pos) {
 		struct variable *var = tag__variable(pos);
@@ -89,29 +129,71 @@ static int findGlobalLockVar(struct cu *cu, void *cookie) {
 			continue;
 		}
 		if (!var->declaration && // Is this a variable definition (--> !declaration)?
-			var->name != 0 && // Does this DW_AT_variable have a name?
-			lockVar->addr >= var->ip.addr && lockVar->addr < (var->ip.addr + tag__size(pos, cu))) {
-			lockVar->lockVarName = variable__name(var, cu);
-			PRINT_DEBUG("", hex << showbase << "addr=" << var->ip.addr << ",size=" << dec << tag__size(pos, cu) << " --> " << lockVar->lockVarName);
-			return 1;
+			var->name != 0) { // Does this DW_AT_variable have a name?
+			uint64_t size = tag__size(pos, cu);
+			if (size > 0) {
+				globalVars->push_back({ var->ip.addr, var->ip.addr + size, variable__name(var, cu), (unsigned)globalVars->size(), 0 });
+			}
 		}
 	}
 	return 0;
 }
 
+/**
+ * Collects every global variable definition of every compilation unit once, and sorts them by address.
+ */
+static void buildGlobalVarIndex(void) {
+	auto start = chrono::steady_clock::now();
+
+	cus__for_each_cu(kernelCUs, collectGlobalVars, &globalVars, NULL);
+	sort(globalVars.begin(), globalVars.end(), [](const GlobalVar &a, const GlobalVar &b) {
+		return a.start < b.start || (a.start == b.start && a.order < b.order);
+	});
+	uint64_t maxEnd = 0;
+	for (auto &globalVar : globalVars) {
+		maxEnd = max(maxEnd, globalVar.end);
+		globalVar.maxEnd = maxEnd;
+	}
+	globalVarsBuilt = true;
+	cerr << "Built the global variable index with " << dec << globalVars.size() << " variables in "
+		<< chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() << "ms" << endl;
+}
+
 const char* getGlobalLockVar(uint64_t addr) {
-	struct lockVarSearch lockVar = { 0 };
-	lockVar.addr = addr;
+	const char *lockVarName = NULL;
+	unsigned order = UINT_MAX;
 
-	cus__for_each_cu(kernelCUs, findGlobalLockVar, &lockVar, NULL);
+	if (!globalVarsBuilt) {
+		buildGlobalVarIndex();
+	}
+	auto start = chrono::steady_clock::now();
+	// Variables may overlap. Like a walk over all compilation units, the definition found first wins.
+	auto it = upper_bound(globalVars.begin(), globalVars.end(), addr, [](uint64_t addr, const GlobalVar &globalVar) {
+		return addr < globalVar.start;
+	});
+	while (it != globalVars.begin()) {
+		--it;
+		if (it->maxEnd <= addr) {
+			break;
+		}
+		if (addr < it->end && it->order < order) {
+			lockVarName = it->name;
+			order = it->order;
+		}
+	}
+	if (lockVarName != NULL) {
+		PRINT_DEBUG("", hex << showbase << "addr=" << addr << " --> " << lockVarName);
+	}
 
-	if (lockVar.lockVarName == NULL) {
+	if (lockVarName == NULL) {
 		auto it = addrToSym.find(addr);
 		if (it != addrToSym.end()) {
-			lockVar.lockVarName = it->second;
+			lockVarName = it->second;
 		}
 	}
-	return lockVar.lockVarName;
+	globalVarLookups++;
+	globalVarLookupTime += chrono::steady_clock::now() - start;
+	return lockVarName;
 }
 
 static int convert_cus_iterator(struct cu *cu, void *cookie) {
@@ -143,6 +225,7 @@ static int convert_cus_iterator(struct cu *cu, void *cookie) {
 			dwarvesconfig.type_id = type.id;
 			if (class__fprintf(ret, cu, cusIterArgs->fp, &dwarvesconfig)) {
 				type.foundInDw = true;
+				cusIterArgs->missingTypes--;
 			}
 		} else {
 			cerr << "Internal error: Found struct for " << type.name << " that is no struct but tag ID " << ret->tag << endl;
@@ -150,10 +233,8 @@ static int convert_cus_iterator(struct cu *cu, void *cookie) {
 	}
 
 	// If at least the information about one datatype is still missing, continue iterating through the cus.
-	for (const auto& type : *cusIterArgs->types) {
-		if (!type.foundInDw) {
-			return 0;
-		}
+	if (cusIterArgs->missingTypes > 0) {
+		return 0;
 	}
 
 	// No need to proceed with the remaining compilation units. Stop iteration.
@@ -175,6 +256,11 @@ int extractStructDefs(const char *outFname, char delimiter, std::vector<DataType
 
 	// Pass the context information to the callback: types array and the outputfile
 	cusIterArgs.types = types;
+	for (const auto& type : *types) {
+		if (!type.foundInDw) {
+			cusIterArgs.missingTypes++;
+		}
+	}
 	cusIterArgs.fp = structsLayoutOFile;
 	cusIterArgs.expand_type = expand_type;
 	cusIterArgs.add_member_name = add_member_name;
@@ -187,7 +273,7 @@ int extractStructDefs(const char *outFname, char delimiter, std::vector<DataType
 }
 
 /* Copied from binutils-2.28/addr2line.c */
-static int slurp_symtab (bfd *abfd)
+static int slurp_symtab (bfd *abfd, asymbol **&bfdSyms, long &bfdSymcount)
 { 
 	long storage;
 	bfd_boolean dynamic = FALSE;
@@ -260,83 +346,194 @@ static void find_address_in_section (bfd *kernelBfd, asection *section, void *da
 		return;
 	}
 
-	bfdSearchCtx->found = bfd_find_nearest_line_discriminator (kernelBfd, section, bfdSyms, bfdSearchCtx->pc - vma,
+	bfdSearchCtx->found = bfd_find_nearest_line_discriminator (kernelBfd, section, bfdSearchCtx->syms, bfdSearchCtx->pc - vma,
 															   &bfdSearchCtx->file, &bfdSearchCtx->fn,
 															   &bfdSearchCtx->line, NULL);
 }
 
-// caching wrapper around cus__get_function_at_addr
-const struct ResolvedInstructionPtr& get_function_at_addr(const char *compDir, uint64_t addr)
-{
-	auto it = functionAddresses.find(addr);
-	if (it == functionAddresses.end()) {
-		BfdSearchCtx bfdSearchCtx;
-		memset(&bfdSearchCtx, 0, sizeof(bfdSearchCtx));
-		
-		bfdSearchCtx.pc = addr;
-		bfd_map_over_sections (kernelBfd, find_address_in_section, &bfdSearchCtx);
-
-		if (bfdSearchCtx.found) {
-			vector<struct CodeLocation>& inlinedBy = functionAddresses[addr].inlinedBy;
-			bfd_boolean foundInline = FALSE;
-			int i = 0;
-
-			functionAddresses[addr].codeLocation.line = bfdSearchCtx.line;
-			if (bfdSearchCtx.file) {
-				const char *tmp = strstr(bfdSearchCtx.file, compDir);
-				size_t len = strlen(compDir);
-				if (tmp) {
-					// If compDir does *not* end with a slash, remove one more char from the filename.
-					// Otherwise, the resulting filename will start with a slash.
-					if (compDir[len - 1] != '/') {
-						functionAddresses[addr].codeLocation.file = bfdSearchCtx.file + len + 1;
-					} else {
-						functionAddresses[addr].codeLocation.file = bfdSearchCtx.file + len;
-					}
+/**
+ * Resolves {@param addr} with libbfd, like addr2line does.
+ * Returns false if no section contains it.
+ */
+static bool find_location_bfd(bfd *abfd, asymbol **syms, uint64_t addr, LineIndexLocation &location, vector<LineIndexLocation> &inlinedBy) {
+	BfdSearchCtx bfdSearchCtx;
+	memset(&bfdSearchCtx, 0, sizeof(bfdSearchCtx));
+
+	bfdSearchCtx.pc = addr;
+	bfdSearchCtx.syms = syms;
+	bfd_map_over_sections (abfd, find_address_in_section, &bfdSearchCtx);
+	if (!bfdSearchCtx.found) {
+		return false;
+	}
+	location = { bfdSearchCtx.fn, bfdSearchCtx.file, (int)bfdSearchCtx.line };
+	// Re-use bfdSearchCtx
+	while (bfd_find_inliner_info(abfd, &bfdSearchCtx.file, &bfdSearchCtx.fn, &bfdSearchCtx.line) == TRUE) {
+		inlinedBy.push_back({ bfdSearchCtx.fn, bfdSearchCtx.file, (int)bfdSearchCtx.line });
+	}
+	return true;
+}
+
+/**
+ * Builds lineIndex, unless it has been tried before, or binaryread_init() has not been asked to.
+ * It must not be called while resolve_addr() is running on other threads.
+ */
+static void build_line_index(void) {
+	if (lineIndexVmlinux.empty()) {
+		return;
+	}
+	auto start = chrono::steady_clock::now();
+	if (!lineIndex.build(lineIndexVmlinux.c_str())) {
+		cerr << "Cannot build the line index. Falling back to libbfd." << endl;
+	} else {
+		cerr << "Built the line index in " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() << "ms" << endl;
+	}
+	lineIndexVmlinux.clear();
+}
+
+/**
+ * Resolves {@param addr} to {@param resolved}. It may be called by several threads at once.
+ */
+static void resolve_addr(const char *compDir, uint64_t addr, ResolvedInstructionPtr &resolved) {
+	LineIndexLocation location;
+	vector<LineIndexLocation> locationInlinedBy;
+	bool found = lineIndex.built() && lineIndex.lookup(addr, location, locationInlinedBy);
+
+	if (!found) {
+		lock_guard<mutex> guard(kernelBfdLock);
+		locationInlinedBy.clear();
+		found = find_location_bfd(kernelBfd, bfdSyms, addr, location, locationInlinedBy);
+	}
+	if (found) {
+		vector<struct CodeLocation>& inlinedBy = resolved.inlinedBy;
+
+		resolved.codeLocation.line = location.line;
+		if (location.file) {
+			const char *tmp = strstr(location.file, compDir);
+			size_t len = strlen(compDir);
+			if (tmp) {
+				// If compDir does *not* end with a slash, remove one more char from the filename.
+				// Otherwise, the resulting filename will start with a slash.
+				if (compDir[len - 1] != '/') {
+					resolved.codeLocation.file = location.file + len + 1;
 				} else {
-					functionAddresses[addr].codeLocation.file = bfdSearchCtx.file;
+					resolved.codeLocation.file = location.file + len;
 				}
 			} else {
-				functionAddresses[addr].codeLocation.file = "unknown";
+				resolved.codeLocation.file = location.file;
 			}
-			if (bfdSearchCtx.fn) {
-				functionAddresses[addr].codeLocation.fn = bfdSearchCtx.fn;
+		} else {
+			resolved.codeLocation.file = "unknown";
+		}
+		if (location.fn) {
+			resolved.codeLocation.fn = location.fn;
+		} else {
+			resolved.codeLocation.fn = "unknown";
+		}
+		for (const LineIndexLocation &inliner : locationInlinedBy) {
+			inlinedBy.push_back(CodeLocation());
+
+			CodeLocation &codeLocation = inlinedBy.back();
+			if (inliner.file && strstr(inliner.file, compDir)) {
+				codeLocation.file = inliner.file + strlen(compDir);
+			} else if (inliner.file) {
+				codeLocation.file = inliner.file;
 			} else {
-				functionAddresses[addr].codeLocation.fn = "unknown";
+				codeLocation.file = "unknown";
 			}
-			while (1) {
-				// Re-use bfdSearchCtx
-				foundInline = bfd_find_inliner_info(kernelBfd, &bfdSearchCtx.file, &bfdSearchCtx.fn, &bfdSearchCtx.line);
-				if (foundInline == TRUE) {
-					inlinedBy.push_back(CodeLocation());
-
-					const char *tmp = strstr(bfdSearchCtx.file, compDir);
-					if (tmp) {
-						inlinedBy[i].file = bfdSearchCtx.file + strlen(compDir);
-					} else {
-						inlinedBy[i].file = bfdSearchCtx.file;
-					}
-					if (bfdSearchCtx.fn) {
-						inlinedBy[i].fn = bfdSearchCtx.fn;
-					} else {
-						inlinedBy[i].fn = "unknown";
-					}
-					inlinedBy[i].line = bfdSearchCtx.line;
-					i++;
-				} else {
-					break;
-				}
+			if (inliner.fn) {
+				codeLocation.fn = inliner.fn;
+			} else {
+				codeLocation.fn = "unknown";
 			}
-		} else {
-			functionAddresses[addr].codeLocation.fn = "unknown";
-			functionAddresses[addr].codeLocation.file = "unknown";
-			functionAddresses[addr].codeLocation.line = 0;
+			codeLocation.line = inliner.line;
 		}
+	} else {
+		resolved.codeLocation.fn = "unknown";
+		resolved.codeLocation.file = "unknown";
+		resolved.codeLocation.line = 0;
+	}
+}
+
+// caching wrapper around cus__get_function_at_addr
+const struct ResolvedInstructionPtr& get_function_at_addr(const char *compDir, uint64_t addr)
+{
+	auto it = functionAddresses.find(addr);
+	if (it == functionAddresses.end()) {
+		build_line_index();
+		resolve_addr(compDir, addr, functionAddresses[addr]);
 		return functionAddresses[addr];
 	}
 	return it->second;
 } 
 
+/**
+ * Opens {@param vmlinuxName} with libbfd, and reads its symbol table into {@param syms}.
+ * Returns NULL, and prints an error message, if that fails.
+ */
+static bfd* open_bfd(const char *vmlinuxName, asymbol **&syms, long &symcount) {
+	// Use NULL as target name for libbfd
+	// Libbfd tries to determine to correct target.
+	bfd *abfd = bfd_openr(vmlinuxName, NULL);
+	if (abfd == NULL) {
+		bfd_perror("open vmlinux");
+		return NULL;
+	}
+	// This check is not only a sanity check. Moreover, it is necessary
+	// to allow looking up of sections.
+	if (!bfd_check_format (abfd, bfd_object)) {
+		cerr << "bfd: unknown format" << endl;
+		bfd_close(abfd);
+		return NULL;
+	}
+	if (slurp_symtab(abfd, syms, symcount)) {
+		fprintf(stderr, "slurp_symtab(..) failed!\n");
+		bfd_close(abfd);
+		return NULL;
+	}
+	return abfd;
+}
+
+unsigned resolve_addrs(const char *compDir, const vector<uint64_t> &addrs, unsigned threads) {
+	vector<uint64_t> pending;
+	for (uint64_t addr : addrs) {
+		if (functionAddresses.find(addr) == functionAddresses.end()) {
+			pending.push_back(addr);
+		}
+	}
+
+	if (!pending.empty()) {
+		build_line_index();
+	}
+	// Only the line index resolves in parallel. The lookups in libbfd take turns.
+	threads = lineIndex.built() ? max(1U, min(threads, (unsigned)(pending.size() / RESOLVE_ADDRS_BATCH + 1))) : 1;
+
+	// Workers take batches of neighbouring addresses, which likely share their compilation unit.
+	vector<ResolvedInstructionPtr> resolved(pending.size());
+	atomic<size_t> nextBatch(0);
+	auto worker = [&]() {
+		size_t begin;
+		while ((begin = nextBatch.fetch_add(RESOLVE_ADDRS_BATCH)) < pending.size()) {
+			size_t end = min(begin + RESOLVE_ADDRS_BATCH, pending.size());
+			for (size_t i = begin; i < end; i++) {
+				resolve_addr(compDir, pending[i], resolved[i]);
+			}
+		}
+	};
+	vector<thread> workers;
+	for (unsigned i = 1; i < threads; i++) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (auto &workerThread : workers) {
+		workerThread.join();
+	}
+
+	for (size_t i = 0; i < pending.size(); i++) {
+		functionAddresses.emplace(pending[i], move(resolved[i]));
+	}
+	return threads;
+}
+
 // find in ELF_SECTIONS specified sections in the kernel
 void readSections(map<string, pair<uint64_t, uint64_t>>& dataSections) {
 	asection *curSection;
@@ -357,28 +554,53 @@ void readSections(map<string, pair<uint64_t, uint64_t>>& dataSections) {
 }
 
 
-int binaryread_init(const char *vmlinuxName) {
+/**
+ * Returns the ELF build-id of the vmlinux, or an empty string if it has none.
+ */
+static string read_build_id(void) {
+	asection *section = bfd_get_section_by_name(kernelBfd, ".note.gnu.build-id");
+	if (section == NULL) {
+		return "";
+	}
+	vector<unsigned char> note(bfd_section_size(section));
+	if (!bfd_get_section_contents(kernelBfd, section, note.data(), 0, note.size())) {
+		return "";
+	}
+	// The note consists of namesz, descsz and type, followed by the name "GNU", and the build-id itself.
+	// The name is padded to four bytes.
+	uint32_t nameSize, descSize;
+	if (note.size() < 12) {
+		return "";
+	}
+	nameSize = bfd_get_32(kernelBfd, note.data());
+	descSize = bfd_get_32(kernelBfd, note.data() + 4);
+	size_t descOffset = 12 + ((nameSize + 3) & ~3U);
+	if (descOffset + descSize > note.size()) {
+		return "";
+	}
+	return string((const char*)note.data() + descOffset, descSize);
+}
+
+void binaryread_load_cache(const char *cacheName, const char *compDir) {
+	string buildId = read_build_id();
+	if (buildId.empty()) {
+		cerr << "The vmlinux has no build-id. Not using the symbol cache." << endl;
+		return;
+	}
+	// The line index and libbfd may resolve an instruction pointer differently. Hence, each has a cache of its own.
+	const char *resolver = lineIndexUsed ? "lineindex" : "libbfd";
+	size_t records = symbolCache.load(cacheName, buildId, compDir, resolver, functionAddresses);
+	cerr << "Loaded " << dec << records << " instruction pointers from the symbol cache " << cacheName << endl;
+}
+
+int binaryread_init(const char *vmlinuxName, bool useLineIndex) {
 	int i;
 	symbol_info syminfo;
 
 	// Init bfd
 	bfd_init();
-	// Use NULL as target name for libbfd
-	// Libbfd tries to determine to correct target.
-	kernelBfd = bfd_openr(vmlinuxName, NULL);
+	kernelBfd = open_bfd(vmlinuxName, bfdSyms, bfdSymcount);
 	if (kernelBfd == NULL) {
-		bfd_perror("open vmlinux");
-		return 1;
-	}
-	// This check is not only a sanity check. Moreover, it is necessary
-	// to allow looking up of sections.
-	if (!bfd_check_format (kernelBfd, bfd_object)) {
-		cerr << "bfd: unknown format" << endl;
-		bfd_close(kernelBfd);
-		return 1;
-	}
-	if (slurp_symtab(kernelBfd)) {
-		fprintf(stderr, "slurp_symtab(..) failed!\n");
 		return 1;
 	}
 
@@ -407,11 +629,25 @@ int binaryread_init(const char *vmlinuxName) {
 		cerr << "No debug information found in " << vmlinuxName << endl;
 		return 1;
 	}
-	
+
+	if (useLineIndex) {
+		lineIndexUsed = true;
+		lineIndexVmlinux = vmlinuxName;
+	}
 	return 0;
 }
 
 void binaryread_destroy(void) {
+	if (globalVarLookups > 0) {
+		cerr << "Looked up " << dec << globalVarLookups << " global lock variables in "
+			<< chrono::duration_cast<chrono::microseconds>(globalVarLookupTime).count() << "us" << endl;
+	}
+	// The names of the new entries point into the bfd.
+	long records = symbolCache.save(functionAddresses);
+	if (records > 0) {
+		cerr << "Appended " << dec << records << " instruction pointers to the symbol cache" << endl;
+	}
+
 	if (bfdSyms != NULL) {
 		free(bfdSyms);
 	}
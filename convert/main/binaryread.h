@@ -6,6 +6,8 @@
 
 using namespace std;
 
+#define RESOLVE_ADDRS_BATCH	256							// Addresses a resolve_addrs() worker takes at once
+
 struct CodeLocation {
 	const char *fn;
 	const char *file;
@@ -27,9 +29,26 @@ struct DataType {
 	bool foundInDw;												// True if the struct has been found in the dwarf information. False otherwise.
 };
 
-int binaryread_init(const char *vmlinuxName);
+/**
+ * Opens {@param vmlinuxName}. If {@param useLineIndex} is set, instruction pointers are resolved
+ * by a LineIndex, and only by libbfd if the index does not know them. The index is built on the first cache miss.
+ */
+int binaryread_init(const char *vmlinuxName, bool useLineIndex);
+/**
+ * Adds the instruction pointers resolved by earlier runs to the cache of get_function_at_addr(). They are read from {@param cacheName},
+ * if it belongs to the same vmlinux, i.e., the same ELF build-id, the same {@param compDir}, and the same resolver, i.e., LineIndex or libbfd.
+ * binaryread_destroy() appends the instruction pointers resolved in this run.
+ */
+void binaryread_load_cache(const char *cacheName, const char *compDir);
 void binaryread_destroy(void);
 const struct ResolvedInstructionPtr& get_function_at_addr(const char *compDir, uint64_t addr);
+/**
+ * Resolves the instruction pointers {@param addrs} on up to {@param threads} threads.
+ * Only the lookups in the line index run in parallel. libbfd is not thread-safe, and resolves on one thread at a time.
+ * Afterwards, get_function_at_addr() answers them from its cache. Sorted {@param addrs} resolve fastest.
+ * Returns the number of threads used.
+ */
+unsigned resolve_addrs(const char *compDir, const vector<uint64_t> &addrs, unsigned threads);
 void readSections(map<string, pair<uint64_t, uint64_t>>& dataSections);
 const char* getGlobalLockVar(uint64_t addr);
 int extractStructDefs(const char *outFname, char delimiter, vector<DataType> *types, expand_type_fn expand_type, add_member_name_fn add_member_name);
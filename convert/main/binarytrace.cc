@@ -0,0 +1,336 @@
+#include <cstring>
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+
+#include "config.h"
+#include "binarytrace.h"
+
+using namespace std;
+
+bool isBinaryTrace(TraceReader *reader) {
+	return reader->peek() == (unsigned char)BINARY_TRACE_MAGIC[0];
+}
+
+bool BinaryTraceDecoder::readHeader() {
+	struct binary_trace_header header;
+
+	if (m_reader->read(&header, sizeof(header)) != sizeof(header) ||
+		memcmp(header.magic, BINARY_TRACE_MAGIC, BINARY_TRACE_MAGIC_LEN) != 0) {
+		cerr << "Invalid binary trace header" << endl;
+		return false;
+	}
+	if (header.version != BINARY_TRACE_VERSION) {
+		cerr << "Unsupported binary trace version " << header.version << ". Expected " << BINARY_TRACE_VERSION << "." << endl;
+		return false;
+	}
+	return true;
+}
+
+static inline uint64_t zigzag(uint64_t delta) {
+	return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t value) {
+	return (value >> 1) ^ -(value & 1);
+}
+
+string_view BinaryTraceDecoder::getString(uint64_t id) {
+	if (id >= m_strings.size()) {
+		throw out_of_range("Unknown string id " + to_string(id));
+	}
+	return m_strings[id];
+}
+
+bool BinaryTraceDecoder::fill() {
+	m_len = m_reader->read(m_buffer.data(), m_buffer.size());
+	m_pos = 0;
+	return m_len > 0;
+}
+
+bool BinaryTraceDecoder::readVarint(uint64_t &value) {
+	unsigned shift = 0;
+
+	value = 0;
+	while (1) {
+		if (m_pos == m_len && !fill()) {
+			return false;
+		}
+		unsigned char byte = m_buffer[m_pos++];
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+		shift += 7;
+		if (shift >= 64) {
+			throw out_of_range("Varint exceeds 64 bits");
+		}
+	}
+}
+
+bool BinaryTraceDecoder::readDelta(uint64_t &value) {
+	if (!readVarint(value)) {
+		return false;
+	}
+	value = unzigzag(value);
+	return true;
+}
+
+bool BinaryTraceDecoder::readBytes(char *dst, size_t len) {
+	while (len > 0) {
+		if (m_pos == m_len && !fill()) {
+			return false;
+		}
+		size_t bytes = min(len, m_len - m_pos);
+		memcpy(dst, m_buffer.data() + m_pos, bytes);
+		m_pos += bytes;
+		dst += bytes;
+		len -= bytes;
+	}
+	return true;
+}
+
+bool BinaryTraceDecoder::nextEvent(TraceEvent &event, bool ctxTracing) {
+	uint64_t value, delta, type, lockMember, file, stacktrace, size, line, ctx, flags, instrPtr;
+	char action;
+
+	try {
+		while (1) {
+			if (m_pos == m_len && !fill()) {
+				return false;
+			}
+			action = m_buffer[m_pos++];
+			if (action != BINARY_TRACE_STRING && action != BINARY_TRACE_FRAMES) {
+				break;
+			}
+			// Extend the string table
+			if (!readVarint(size)) {
+				throw out_of_range("truncated");
+			}
+			if (action == BINARY_TRACE_STRING) {
+				m_strings.emplace_back((size_t)size, '\0');
+				if (!readBytes(&m_strings.back()[0], size)) {
+					throw out_of_range("truncated");
+				}
+				continue;
+			}
+			string &frames = m_strings.emplace_back();
+			uint64_t frame = 0;
+			char digits[16];
+			for (uint64_t i = 0; i < size; i++) {
+				if (!readVarint(frame)) {
+					throw out_of_range("truncated");
+				}
+				auto res = to_chars(digits, digits + sizeof(digits), frame, 16);
+				frames.append(digits, res.ptr - digits);
+				frames.push_back(',');
+			}
+		}
+
+		// Fill in exactly the members parseCSVEvent() fills in for the respective action
+		if (!readDelta(delta)) {
+			throw out_of_range("truncated");
+		}
+		m_state.ts += delta;
+		event.ts = m_state.ts;
+		event.reset();
+		event.action = action;
+		switch (event.action) {
+		case LOCKDOC_ALLOC:
+		case LOCKDOC_FREE:
+			if (!readDelta(delta) || !readVarint(size) || !readVarint(type)) {
+				throw out_of_range("truncated");
+			}
+			m_state.address += delta;
+			event.address = m_state.address;
+			event.size = size;
+			event.type = getString(type);
+			break;
+		case LOCKDOC_LOCK_OP:
+			if (m_pos == m_len && !fill()) {
+				throw out_of_range("truncated");
+			}
+			value = (unsigned char)m_buffer[m_pos++];
+			if (value > V_WRITE) {
+				cerr << "Line (ts=" << event.ts << ") contains invalid value for lock_op" << endl;
+				m_failed = true;
+				return false;
+			}
+			if (!readDelta(delta) || !readVarint(lockMember) || !readVarint(file) || !readVarint(line) ||
+				!readVarint(type) || !readDelta(flags) || !readDelta(ctx)) {
+				throw out_of_range("truncated");
+			}
+			event.lockOP = (enum LOCK_OP)value;
+			m_state.address += delta;
+			event.address = m_state.address;
+			event.lockMember = getString(lockMember);
+			event.file = getString(file);
+			event.line = line;
+			event.type = getString(type);
+			event.flags = (int64_t)flags;
+			event.ctx = ctxTracing ? (int64_t)ctx : DUMMY_EXECUTION_CONTEXT;
+			break;
+		case LOCKDOC_READ:
+		case LOCKDOC_WRITE:
+			if (!readDelta(delta) || !readDelta(value) || !readVarint(size) || !readDelta(instrPtr) ||
+				!readVarint(stacktrace) || !readDelta(ctx)) {
+				throw out_of_range("truncated");
+			}
+			m_state.base_address += delta;
+			event.baseAddress = m_state.base_address;
+			event.address = m_state.base_address + value;
+			event.size = size;
+			m_state.instrptr += instrPtr;
+			event.instrPtr = m_state.instrptr;
+			event.stacktrace = getString(stacktrace);
+			event.ctx = (int64_t)ctx;
+			break;
+		}
+	} catch (exception &e) {
+		cerr << "Binary trace is corrupt (ts=" << event.ts << "): " << e.what() << endl;
+		m_failed = true;
+		return false;
+	}
+	return true;
+}
+
+void BinaryTraceEncoder::writeHeader() {
+	struct binary_trace_header header;
+
+	memcpy(header.magic, BINARY_TRACE_MAGIC, BINARY_TRACE_MAGIC_LEN);
+	header.version = BINARY_TRACE_VERSION;
+	m_out.write((const char*)&header, sizeof(header));
+}
+
+void BinaryTraceEncoder::writeVarint(uint64_t value) {
+	while (value >= 0x80) {
+		m_record.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	m_record.push_back((char)value);
+}
+
+void BinaryTraceEncoder::writeDelta(uint64_t value, uint64_t &prev) {
+	writeVarint(zigzag(value - prev));
+	prev = value;
+}
+
+/**
+ * Returns whether {@param stacktrace} consists of lowercase hexadecimal numbers without leading zeros,
+ * each one followed by a comma, i.e., whether BINARY_TRACE_FRAMES reproduces it exactly.
+ */
+static bool isCanonicalStacktrace(string_view stacktrace) {
+	size_t digits = 0;
+	bool leadingZero = false;
+
+	for (char c : stacktrace) {
+		if (c == ',') {
+			if (digits == 0) {
+				return false;
+			}
+			digits = 0;
+		} else if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')) {
+			// Leading zeros would get lost, e.g., 0c1133bfb would come back as c1133bfb.
+			if (digits == 0) {
+				leadingZero = c == '0';
+			} else if (leadingZero) {
+				return false;
+			}
+			if (++digits > 16) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+	}
+	return digits == 0;
+}
+
+bool BinaryTraceEncoder::writeFrames(string_view stacktrace) {
+	uint64_t frame = 0;
+
+	if (!isCanonicalStacktrace(stacktrace)) {
+		return false;
+	}
+	m_record.clear();
+	m_record.push_back(BINARY_TRACE_FRAMES);
+	writeVarint(count(stacktrace.begin(), stacktrace.end(), ','));
+	for (size_t pos = 0; pos < stacktrace.size(); pos = stacktrace.find(',', pos) + 1) {
+		from_chars(stacktrace.data() + pos, stacktrace.data() + stacktrace.size(), frame, 16);
+		writeVarint(frame);
+	}
+	m_out.write(m_record.data(), m_record.size());
+	return true;
+}
+
+uint64_t BinaryTraceEncoder::internString(string_view str, bool stacktrace) {
+	if (str.empty()) {
+		return 0;
+	}
+	auto it = m_stringIDs.find(string(str));
+	if (it != m_stringIDs.end()) {
+		return it->second;
+	}
+	// Unknown string: define it before the record using it
+	if (!stacktrace || !writeFrames(str)) {
+		m_record.clear();
+		m_record.push_back(BINARY_TRACE_STRING);
+		writeVarint(str.size());
+		m_out.write(m_record.data(), m_record.size());
+		m_out.write(str.data(), str.size());
+	}
+	m_stringIDs.emplace(str, m_nextStringID);
+	return m_nextStringID++;
+}
+
+void BinaryTraceEncoder::writeEvent(const TraceEvent &event) {
+	// The strings have to be defined before the record is written.
+	uint64_t type = 0, lockMember = 0, file = 0, stacktrace = 0;
+	switch (event.action) {
+	case LOCKDOC_ALLOC:
+	case LOCKDOC_FREE:
+		type = internString(event.type);
+		break;
+	case LOCKDOC_LOCK_OP:
+		lockMember = internString(event.lockMember);
+		file = internString(event.file);
+		type = internString(event.type);
+		break;
+	case LOCKDOC_READ:
+	case LOCKDOC_WRITE:
+		stacktrace = internString(event.stacktrace, true);
+		break;
+	}
+
+	m_record.clear();
+	m_record.push_back(event.action);
+	writeDelta(event.ts, m_state.ts);
+	switch (event.action) {
+	case LOCKDOC_ALLOC:
+	case LOCKDOC_FREE:
+		writeDelta(event.address, m_state.address);
+		writeVarint(event.size);
+		writeVarint(type);
+		break;
+	case LOCKDOC_LOCK_OP:
+		m_record.push_back(event.lockOP);
+		writeDelta(event.address, m_state.address);
+		writeVarint(lockMember);
+		writeVarint(file);
+		writeVarint(event.line);
+		writeVarint(type);
+		writeVarint(zigzag(event.flags));
+		writeVarint(zigzag(event.ctx));
+		break;
+	case LOCKDOC_READ:
+	case LOCKDOC_WRITE:
+		writeDelta(event.baseAddress, m_state.base_address);
+		writeVarint(zigzag(event.address - event.baseAddress));
+		writeVarint(event.size);
+		writeDelta(event.instrPtr, m_state.instrptr);
+		writeVarint(stacktrace);
+		writeVarint(zigzag(event.ctx));
+		break;
+	}
+	m_out.write(m_record.data(), m_record.size());
+}
@@ -0,0 +1,137 @@
+#ifndef __BINARYTRACE_H__
+#define __BINARYTRACE_H__
+
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "lockdoc_event.h"
+#include "tracereader.h"
+
+/**
+ * A compact binary encoding of the input trace.
+ *
+ * The file starts with a struct binary_trace_header, followed by a sequence of
+ * variable-length records. Each record starts with its action (enum LOCKDOC_OP,
+ * or BINARY_TRACE_STRING), and only carries the fields of this action:
+ * - LOCKDOC_ALLOC, LOCKDOC_FREE: ts, address, size, type
+ * - LOCKDOC_LOCK_OP: ts, lock_op (one byte), address, lock_member, file, line, type, flags, ctx
+ * - LOCKDOC_READ, LOCKDOC_WRITE: ts, base_address, address, size, instrptr, stacktrace, ctx
+ * - BINARY_TRACE_STRING: length, followed by the characters of the string
+ * - BINARY_TRACE_FRAMES: a stacktrace string, e.g., "c1133bfb,c110b115,", as the number of its
+ *   return addresses, followed by each one as zigzag-encoded difference to its predecessor.
+ *   The decoder turns it back into lowercase hexadecimal numbers, each one followed by a comma.
+ * All numbers are LEB128 varints. The timestamp, the base address, the instruction pointer,
+ * and the address of an allocation or a lock are stored as the zigzag-encoded difference
+ * to their predecessor. The address of a memory access is stored relative to its base address.
+ * Hence, most fields of a record fit into a single byte.
+ *
+ * Like struct log_action, a record does not carry any strings. The type, the lock member,
+ * the file, and the stacktrace are interned into a string table, and the record only
+ * refers to their ids. Before a string id is used for the first time, a BINARY_TRACE_STRING
+ * or BINARY_TRACE_FRAMES record defines it, i.e., the strings are numbered in the order of their definition.
+ * Id 0 always denotes the empty string.
+ *
+ * Binary traces are usually gzip'ed, which is recognized by convert as well.
+ */
+#define BINARY_TRACE_MAGIC		"\x89LDT"
+#define BINARY_TRACE_MAGIC_LEN	4
+#define BINARY_TRACE_VERSION	2
+#define BINARY_TRACE_STRING		's'
+#define BINARY_TRACE_FRAMES		'S'
+#define BINARY_TRACE_BUFFER		(64 << 10)			// Bytes the decoder reads from the trace at once
+
+struct binary_trace_header {
+	char magic[BINARY_TRACE_MAGIC_LEN];
+	uint32_t version;
+}__attribute__((packed));
+
+/**
+ * The values the deltas of the next record refer to. Both, encoder and decoder, start with all of them being zero.
+ */
+struct binary_trace_state {
+	uint64_t ts;
+	uint64_t address;			// Of the last allocation, free, or lock operation
+	uint64_t base_address;
+	uint64_t instrptr;
+};
+
+/**
+ * Returns true if the trace read by {@param reader} is a binary trace.
+ */
+bool isBinaryTrace(TraceReader *reader);
+
+/**
+ * Reads a binary trace, and turns each record into a TraceEvent.
+ * No text is parsed at all.
+ */
+struct BinaryTraceDecoder {
+	BinaryTraceDecoder(TraceReader *reader) : m_reader(reader), m_state(), m_pos(0), m_len(0), m_buffer(BINARY_TRACE_BUFFER), m_failed(false) {
+		m_strings.emplace_back();
+	}
+	/**
+	 * Check the header of the trace.
+	 * Returns false, and prints an error message, if it is invalid.
+	 */
+	bool readHeader();
+	/**
+	 * Read the next event into {@param event}.
+	 * If {@param ctxTracing} is false, the context of lock operations is ignored.
+	 * Returns false at the end of the trace, or if the trace is corrupt. failed() tells them apart.
+	 * In the latter case, an error message has already been printed.
+	 */
+	bool nextEvent(TraceEvent &event, bool ctxTracing);
+	bool failed() const {
+		return m_failed;
+	}
+
+	private:
+	TraceReader *m_reader;
+	std::deque<std::string> m_strings;							// String table, indexed by string id. A deque keeps the strings in place while growing.
+	struct binary_trace_state m_state;
+	size_t m_pos;												// Next byte in m_buffer
+	size_t m_len;												// Valid bytes in m_buffer
+	std::vector<char> m_buffer;
+	bool m_failed;												// The trace is corrupt, or truncated
+
+	std::string_view getString(uint64_t id);
+	/**
+	 * Refill m_buffer. Returns false at the end of the trace.
+	 */
+	bool fill();
+	/**
+	 * Read a varint into {@param value}. Returns false at the end of the trace.
+	 */
+	bool readVarint(uint64_t &value);
+	bool readDelta(uint64_t &value);
+	bool readBytes(char *dst, size_t len);
+};
+
+/**
+ * Writes TraceEvents as a binary trace.
+ */
+struct BinaryTraceEncoder {
+	BinaryTraceEncoder(std::ostream &out) : m_out(out), m_nextStringID(1), m_state() { }
+	void writeHeader();
+	/**
+	 * Append {@param event} to the trace.
+	 */
+	void writeEvent(const TraceEvent &event);
+
+	private:
+	std::ostream &m_out;
+	std::unordered_map<std::string, uint64_t> m_stringIDs;		// String table: string -> id
+	uint64_t m_nextStringID;
+	struct binary_trace_state m_state;
+	std::string m_record;										// The record being encoded
+
+	uint64_t internString(std::string_view str, bool stacktrace = false);
+	bool writeFrames(std::string_view stacktrace);
+	void writeVarint(uint64_t value);
+	void writeDelta(uint64_t value, uint64_t &prev);
+};
+
+#endif // __BINARYTRACE_H__
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "config.h"
+#include "git_version.h"
+#include "columnfile.h"
+#include "csvwriter.h"
+
+/**
+ * Prints a column file (see columnfile.h), e.g., accesses.ldc written by convert -a, as CSV.
+ * Only the columns asked for are decoded. With all columns, the output is the CSV convert would have written,
+ * apart from the header.
+ */
+
+using namespace std;
+
+char delimiter = DELIMITER_CHAR;
+
+static void printUsageAndExit(const char *elf) {
+	cerr << "usage: " << elf
+		<< " [options] input.ldc|-\n\n"
+		"Options:\n"
+		" -d  delimiter used in the output, default: " << delimiter << "\n"
+		" -c  comma-separated list of the columns to print, default: all\n"
+		" -v  show version\n"
+		" -h  Print this help\n";
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	const char *columnList = NULL;
+	int param;
+
+	while ((param = getopt(argc,argv,"d:c:vh")) != -1) {
+		switch (param) {
+		case 'd':
+			delimiter = *optarg;
+			break;
+		case 'c':
+			columnList = optarg;
+			break;
+		case 'v':
+			cerr << "col2csv version: " << GIT_BRANCH << ", " << GIT_MESSAGE << endl;
+			return EXIT_SUCCESS;
+		case 'h':
+		default:
+			printUsageAndExit(argv[0]);
+		}
+	}
+	if (argc - optind != 1) {
+		printUsageAndExit(argv[0]);
+	}
+	const char *inName = argv[optind];
+
+	ifstream inFile;
+	istream *in = &cin;
+	if (string(inName) != "-") {
+		inFile.open(inName, std::ifstream::in | std::ifstream::binary);
+		if (!inFile.is_open()) {
+			cerr << "Cannot open file: " << inName << endl;
+			return EXIT_FAILURE;
+		}
+		in = &inFile;
+	}
+	ColumnFileReader reader(*in);
+	if (!reader.readHeader()) {
+		return EXIT_FAILURE;
+	}
+
+	// Columns to be printed, in the order given
+	const auto &columns = reader.columns();
+	vector<size_t> printed;
+	vector<bool> wanted(columns.size());
+	if (columnList) {
+		stringstream ss(columnList);
+		string name;
+		while (getline(ss, name, ',')) {
+			size_t i;
+			for (i = 0; i < columns.size() && columns[i].name != name; i++);
+			if (i == columns.size()) {
+				cerr << "Unknown column: " << name << endl;
+				return EXIT_FAILURE;
+			}
+			printed.push_back(i);
+			wanted[i] = true;
+		}
+	} else {
+		for (size_t i = 0; i < columns.size(); i++) {
+			printed.push_back(i);
+			wanted[i] = true;
+		}
+	}
+
+	CSVWriter out;
+	vector<const char*> names;
+	for (size_t i : printed) {
+		names.push_back(columns[i].name.c_str());
+	}
+	out.open(STDOUT_FILENO, "stdout", { delimiter, false, false, false, NULL });
+	out.header(names, {});
+	while (reader.nextRowGroup(wanted)) {
+		for (size_t row = 0; row < reader.rows(); row++) {
+			for (size_t i : printed) {
+				uint64_t value = reader.values(i)[row];
+				switch (columns[i].kind) {
+				case COLUMN_FILE_SIGNED:
+					out.field((int64_t)value);
+					break;
+				case COLUMN_FILE_CHAR:
+					out.field((char)value);
+					break;
+				case COLUMN_FILE_ID:
+					out.nullIf(value, value == 0);
+					break;
+				default:
+					out.field(value);
+				}
+			}
+			out.endRow();
+		}
+	}
+	// Writes the remaining rows. A write error has already been reported.
+	out.close();
+	return reader.failed() || out.failed() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include "columnfile.h"
+
+using namespace std;
+
+template <typename T>
+static void putRaw(string &out, T value) {
+	out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool getRaw(const char *&pos, const char *end, T &value) {
+	if ((size_t)(end - pos) < sizeof(value)) {
+		return false;
+	}
+	memcpy(&value, pos, sizeof(value));
+	pos += sizeof(value);
+	return true;
+}
+
+static unsigned bitWidth(uint64_t value) {
+	return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+static void packBits(string &out, const uint64_t *values, size_t count, unsigned width) {
+	if (width == 0) {
+		return;
+	}
+	unsigned __int128 acc = 0;
+	unsigned bits = 0;
+	for (size_t i = 0; i < count; i++) {
+		acc |= (unsigned __int128)values[i] << bits;
+		bits += width;
+		while (bits >= 8) {
+			out.push_back((char)acc);
+			acc >>= 8;
+			bits -= 8;
+		}
+	}
+	if (bits > 0) {
+		out.push_back((char)acc);
+	}
+}
+
+static bool unpackBits(const char *&pos, const char *end, uint64_t *values, size_t count, unsigned width) {
+	if (width > 64) {
+		return false;
+	}
+	if (width == 0) {
+		fill(values, values + count, 0);
+		return true;
+	}
+	if ((size_t)(end - pos) < (count * width + 7) / 8) {
+		return false;
+	}
+	uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+	unsigned __int128 acc = 0;
+	unsigned bits = 0;
+	for (size_t i = 0; i < count; i++) {
+		while (bits < width) {
+			acc |= (unsigned __int128)(uint8_t)*pos++ << bits;
+			bits += 8;
+		}
+		values[i] = (uint64_t)acc & mask;
+		acc >>= width;
+		bits -= width;
+	}
+	return true;
+}
+
+/**
+ * Appends the payload of a COLUMN_FILE_DELTA chunk holding the {@param count} > 0 {@param values}.
+ * {@param deltas} is scratch space.
+ */
+static void encodeDelta(string &out, const uint64_t *values, size_t count, vector<uint64_t> &deltas) {
+	putRaw(out, values[0]);
+	if (count == 1) {
+		return;
+	}
+	int64_t minDelta = INT64_MAX;
+	for (size_t i = 1; i < count; i++) {
+		minDelta = min(minDelta, (int64_t)(values[i] - values[i - 1]));
+	}
+	deltas.resize(count - 1);
+	uint64_t bits = 0;
+	for (size_t i = 1; i < count; i++) {
+		deltas[i - 1] = values[i] - values[i - 1] - (uint64_t)minDelta;
+		bits |= deltas[i - 1];
+	}
+	unsigned width = bitWidth(bits);
+	putRaw(out, minDelta);
+	putRaw(out, (uint8_t)width);
+	packBits(out, deltas.data(), deltas.size(), width);
+}
+
+static bool decodeDelta(const char *&pos, const char *end, uint64_t *values, size_t count) {
+	if (!getRaw(pos, end, values[0])) {
+		return false;
+	}
+	if (count == 1) {
+		return true;
+	}
+	int64_t minDelta;
+	uint8_t width;
+	if (!getRaw(pos, end, minDelta) || !getRaw(pos, end, width) || !unpackBits(pos, end, values + 1, count - 1, width)) {
+		return false;
+	}
+	for (size_t i = 1; i < count; i++) {
+		values[i] += values[i - 1] + (uint64_t)minDelta;
+	}
+	return true;
+}
+
+/**
+ * Appends the payload of a COLUMN_FILE_DICT chunk holding the {@param count} > 0 {@param values}.
+ * {@param dict}, {@param indices}, and {@param deltas} are scratch space.
+ */
+static void encodeDict(string &out, const uint64_t *values, size_t count, vector<uint64_t> &dict, vector<uint64_t> &indices, vector<uint64_t> &deltas) {
+	dict.assign(values, values + count);
+	sort(dict.begin(), dict.end());
+	dict.erase(unique(dict.begin(), dict.end()), dict.end());
+	putRaw(out, (uint32_t)dict.size());
+	encodeDelta(out, dict.data(), dict.size(), deltas);
+	indices.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		indices[i] = lower_bound(dict.begin(), dict.end(), values[i]) - dict.begin();
+	}
+	unsigned width = bitWidth(dict.size() - 1);
+	putRaw(out, (uint8_t)width);
+	packBits(out, indices.data(), count, width);
+}
+
+/**
+ * Decodes the payload of a COLUMN_FILE_DICT chunk into the {@param count} {@param values}.
+ * {@param dict} is scratch space.
+ */
+static bool decodeDict(const char *&pos, const char *end, uint64_t *values, size_t count, vector<uint64_t> &dict) {
+	uint32_t dictSize;
+	uint8_t width;
+	if (!getRaw(pos, end, dictSize) || dictSize == 0 || dictSize > count) {
+		return false;
+	}
+	dict.resize(dictSize);
+	if (!decodeDelta(pos, end, dict.data(), dictSize) || !getRaw(pos, end, width) || !unpackBits(pos, end, values, count, width)) {
+		return false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (values[i] >= dictSize) {
+			return false;
+		}
+		values[i] = dict[values[i]];
+	}
+	return true;
+}
+
+ColumnFileWriter::ColumnFileWriter(ostream &out, const vector<ColumnSpec> &columns) :
+	m_out(out), m_values(columns.size()), m_chunks(columns.size()), m_size(0) {
+	struct column_file_header header;
+	memcpy(header.magic, COLUMN_FILE_MAGIC, COLUMN_FILE_MAGIC_LEN);
+	header.version = COLUMN_FILE_VERSION;
+	header.columns = columns.size();
+	string data(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const auto &column : columns) {
+		uint8_t nameLen = min(column.name.size(), (size_t)UINT8_MAX);
+		putRaw(data, (uint8_t)column.kind);
+		putRaw(data, nameLen);
+		data.append(column.name, 0, nameLen);
+	}
+	write(data);
+	for (auto &values : m_values) {
+		values.reserve(COLUMN_FILE_ROW_GROUP);
+	}
+}
+
+ColumnFileWriter::~ColumnFileWriter() {
+	writeRowGroup();
+	m_out.flush();
+}
+
+void ColumnFileWriter::writeRowGroup() {
+	size_t rows = m_values[0].size();
+	if (rows == 0) {
+		return;
+	}
+	string header;
+	putRaw(header, (uint32_t)rows);
+	for (size_t i = 0; i < m_values.size(); i++) {
+		// Take the smaller encoding
+		string &chunk = m_chunks[i];
+		chunk.assign(1, (char)COLUMN_FILE_DELTA);
+		encodeDelta(chunk, m_values[i].data(), rows, m_deltas);
+		m_alternative.assign(1, (char)COLUMN_FILE_DICT);
+		encodeDict(m_alternative, m_values[i].data(), rows, m_dict, m_indices, m_deltas);
+		if (m_alternative.size() < chunk.size()) {
+			chunk.swap(m_alternative);
+		}
+		putRaw(header, (uint64_t)chunk.size());
+		m_values[i].clear();
+	}
+	write(header);
+	for (const auto &chunk : m_chunks) {
+		write(chunk);
+	}
+}
+
+void ColumnFileWriter::write(const string &data) {
+	m_out.write(data.data(), data.size());
+	m_size += data.size();
+}
+
+bool ColumnFileReader::readHeader() {
+	struct column_file_header header;
+	if (!m_in.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, COLUMN_FILE_MAGIC, COLUMN_FILE_MAGIC_LEN)) {
+		cerr << "Not a column file" << endl;
+		return false;
+	}
+	if (header.version != COLUMN_FILE_VERSION) {
+		cerr << "Unsupported column file version: " << dec << header.version << endl;
+		return false;
+	}
+	m_columns.resize(header.columns);
+	for (auto &column : m_columns) {
+		uint8_t kind, nameLen;
+		if (!m_in.read(reinterpret_cast<char*>(&kind), 1) || !m_in.read(reinterpret_cast<char*>(&nameLen), 1)) {
+			cerr << "Truncated column file header" << endl;
+			return false;
+		}
+		column.kind = (enum COLUMN_FILE_KIND)kind;
+		column.name.resize(nameLen);
+		if (!m_in.read(&column.name[0], nameLen)) {
+			cerr << "Truncated column file header" << endl;
+			return false;
+		}
+	}
+	m_values.resize(m_columns.size());
+	return true;
+}
+
+bool ColumnFileReader::nextRowGroup(const vector<bool> &wanted) {
+	uint32_t rows;
+	if (!m_in.read(reinterpret_cast<char*>(&rows), sizeof(rows))) {
+		if (m_in.gcount() != 0) {
+			return corrupt("Truncated row group");
+		}
+		return false;
+	}
+	vector<uint64_t> sizes(m_columns.size());
+	if (rows == 0 || rows > COLUMN_FILE_ROW_GROUP || !m_in.read(reinterpret_cast<char*>(sizes.data()), sizes.size() * sizeof(uint64_t))) {
+		return corrupt("Corrupt row group");
+	}
+	m_rows = rows;
+	for (size_t i = 0; i < m_columns.size(); i++) {
+		// No encoding takes more than three words per value.
+		if (sizes[i] > 64 + 3 * sizeof(uint64_t) * (uint64_t)rows) {
+			return corrupt("Corrupt row group");
+		}
+		if (i >= wanted.size() || !wanted[i]) {
+			m_values[i].clear();
+			if (!m_in.ignore(sizes[i]) || (uint64_t)m_in.gcount() != sizes[i]) {
+				return corrupt("Truncated row group");
+			}
+			continue;
+		}
+		m_chunk.resize(sizes[i]);
+		if (!m_in.read(&m_chunk[0], sizes[i])) {
+			return corrupt("Truncated row group");
+		}
+		m_values[i].resize(rows);
+		const char *pos = m_chunk.data(), *end = pos + m_chunk.size();
+		uint8_t encoding;
+		bool ok = getRaw(pos, end, encoding);
+		if (ok && encoding == COLUMN_FILE_DELTA) {
+			ok = decodeDelta(pos, end, m_values[i].data(), rows);
+		} else if (ok && encoding == COLUMN_FILE_DICT) {
+			ok = decodeDict(pos, end, m_values[i].data(), rows, m_dict);
+		} else {
+			ok = false;
+		}
+		if (!ok || pos != end) {
+			cerr << "Corrupt chunk of column " << m_columns[i].name << endl;
+			m_failed = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ColumnFileReader::corrupt(const char *msg) {
+	cerr << msg << endl;
+	m_failed = true;
+	return false;
+}
@@ -0,0 +1,145 @@
+#ifndef __COLUMNFILE_H__
+#define __COLUMNFILE_H__
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * The LockDoc column file format, a compact columnar encoding of a table, e.g., accesses.
+ * Every value is an unsigned 64-bit integer. The kind of a column tells how to print it.
+ *
+ * The file starts with a struct column_file_header, followed by a description of each column:
+ * its kind (uint8_t), the length of its name (uint8_t), and the name.
+ * The rows follow in row groups of at most COLUMN_FILE_ROW_GROUP rows. A row group starts with
+ * its number of rows (uint32_t), and the size of each column chunk in bytes (uint64_t).
+ * The column chunks follow in column order. Hence, a reader can skip the columns it does not need.
+ * A chunk holds all values of its column within the row group, and starts with its encoding (uint8_t):
+ *
+ * - COLUMN_FILE_DELTA: the first value (uint64_t). If there are further rows, the smallest difference
+ *   between consecutive values (int64_t), the bit width (uint8_t), and the differences minus the
+ *   smallest one, bit-packed.
+ * - COLUMN_FILE_DICT: the number of distinct values (uint32_t), the distinct values in ascending
+ *   order as a COLUMN_FILE_DELTA chunk, the bit width (uint8_t), and each value's index into them, bit-packed.
+ *
+ * Bit-packed values fill the bytes starting at the least significant bit, and the last byte is padded with zeros.
+ * A width of 0 means that all values are 0, and take no space at all. Monotonic IDs thereby vanish.
+ * The writer chooses the smaller encoding per chunk.
+ * All numbers are stored in host byte order. The file ends after the last row group.
+ */
+#define COLUMN_FILE_MAGIC		"\x89LDC"
+#define COLUMN_FILE_MAGIC_LEN	4
+#define COLUMN_FILE_VERSION		1
+#define COLUMN_FILE_ROW_GROUP	(1 << 16)		// Maximum number of rows in a row group
+
+enum COLUMN_FILE_KIND {
+	COLUMN_FILE_UNSIGNED = 0,
+	COLUMN_FILE_SIGNED,								// Two's complement
+	COLUMN_FILE_CHAR,								// A single character, e.g., the access type
+	COLUMN_FILE_ID									// An ID, 0 stands for NULL
+};
+
+enum COLUMN_FILE_ENCODING {
+	COLUMN_FILE_DELTA = 0,
+	COLUMN_FILE_DICT
+};
+
+struct column_file_header {
+	char magic[COLUMN_FILE_MAGIC_LEN];
+	uint32_t version;
+	uint32_t columns;
+}__attribute__((packed));
+
+struct ColumnSpec {
+	std::string name;
+	enum COLUMN_FILE_KIND kind;
+};
+
+/**
+ * Writes rows to {@param out} in the column file format.
+ * Rows are gathered until a row group is full, and each column of it is encoded separately.
+ */
+struct ColumnFileWriter {
+	ColumnFileWriter(std::ostream &out, const std::vector<ColumnSpec> &columns);
+	/**
+	 * Writes the remaining rows.
+	 */
+	~ColumnFileWriter();
+	/**
+	 * Appends a row, which has one value per column.
+	 */
+	void addRow(const uint64_t *values) {
+		for (size_t i = 0; i < m_values.size(); i++) {
+			m_values[i].push_back(values[i]);
+		}
+		if (m_values[0].size() == COLUMN_FILE_ROW_GROUP) {
+			writeRowGroup();
+		}
+	}
+	/**
+	 * Returns the number of bytes written so far.
+	 */
+	uint64_t size() const {
+		return m_size;
+	}
+
+	private:
+	std::ostream &m_out;
+	std::vector<std::vector<uint64_t>> m_values;				// The pending values of each column
+	std::vector<std::string> m_chunks;							// Scratch space for the encoded chunks
+	std::string m_alternative;									// Scratch space for the other encoding of a chunk
+	std::vector<uint64_t> m_deltas;								// Scratch space for encodeDelta()
+	std::vector<uint64_t> m_dict;								// Scratch space for encodeDict()
+	std::vector<uint64_t> m_indices;							// Scratch space for encodeDict()
+	uint64_t m_size;
+
+	void writeRowGroup();
+	void write(const std::string &data);
+};
+
+/**
+ * Reads a column file from {@param in}, one row group at a time.
+ */
+struct ColumnFileReader {
+	ColumnFileReader(std::istream &in) : m_in(in), m_rows(0), m_failed(false) { }
+	/**
+	 * Check the header, and read the column descriptions.
+	 * Returns false, and prints an error message, if the header is invalid.
+	 */
+	bool readHeader();
+	const std::vector<ColumnSpec>& columns() const {
+		return m_columns;
+	}
+	/**
+	 * Read the next row group. Only the columns flagged in {@param wanted} are decoded, the others are skipped.
+	 * Returns false at the end of the file, or if the file is corrupt. In the latter case, an error message has already been printed.
+	 */
+	bool nextRowGroup(const std::vector<bool> &wanted);
+	bool failed() const {
+		return m_failed;
+	}
+	size_t rows() const {
+		return m_rows;
+	}
+	/**
+	 * The values of the column {@param column} within the current row group, if it has been wanted.
+	 */
+	const std::vector<uint64_t>& values(size_t column) const {
+		return m_values[column];
+	}
+
+	private:
+	std::istream &m_in;
+	std::vector<ColumnSpec> m_columns;
+	size_t m_rows;
+	bool m_failed;
+	std::vector<std::vector<uint64_t>> m_values;
+	std::string m_chunk;
+	std::vector<uint64_t> m_dict;								// Scratch space for decoding a COLUMN_FILE_DICT chunk
+
+	bool corrupt(const char *msg);
+};
+
+#endif // __COLUMNFILE_H__
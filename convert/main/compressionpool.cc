@@ -0,0 +1,114 @@
+#include <iostream>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "compressionpool.h"
+
+using namespace std;
+
+CompressionPool::CompressionPool(enum COMPRESSION compression, unsigned threads) :
+	m_compression(compression), m_stop(false) {
+	if (threads == 0) {
+		threads = max(1U, thread::hardware_concurrency());
+	}
+	for (unsigned i = 0; i < threads; i++) {
+		m_workers.emplace_back(&CompressionPool::worker, this);
+	}
+}
+
+CompressionPool::~CompressionPool() {
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_stop = true;
+	}
+	m_jobReady.notify_all();
+	for (auto &worker : m_workers) {
+		worker.join();
+	}
+}
+
+const char* CompressionPool::extension() const {
+	return m_compression == COMPRESSION_GZIP ? ".gz" : ".zst";
+}
+
+void CompressionPool::compress(CompressedBlockSink *sink, size_t block, vector<char> &&data) {
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_jobs.push_back({ sink, block, std::move(data) });
+	}
+	m_jobReady.notify_one();
+}
+
+void CompressionPool::worker() {
+	ZSTD_CCtx *zstdCtx = NULL;
+	z_stream zs = {};
+	bool ok;
+
+	// Each worker keeps its own context for all of its blocks.
+	if (m_compression == COMPRESSION_ZSTD) {
+		zstdCtx = ZSTD_createCCtx();
+		ok = zstdCtx != NULL && !ZSTD_isError(ZSTD_CCtx_setParameter(zstdCtx, ZSTD_c_compressionLevel, COMPRESSION_ZSTD_LEVEL));
+	} else {
+		// 15 + 16: the largest window, and a gzip header instead of a zlib one
+		ok = deflateInit2(&zs, COMPRESSION_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+	}
+	if (!ok) {
+		cerr << "Cannot create compression context" << endl;
+	}
+	while (1) {
+		Job job;
+		{
+			unique_lock<mutex> guard(m_lock);
+			m_jobReady.wait(guard, [this] { return m_stop || !m_jobs.empty(); });
+			if (m_jobs.empty()) {
+				break;
+			}
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		vector<char> out;
+		if (ok && !(m_compression == COMPRESSION_ZSTD ? compressZSTD(zstdCtx, job.data, out) : compressGZIP(&zs, job.data, out))) {
+			out.clear();
+		}
+		// Hand over an empty block on failure, which fails the writer. The error has already been reported.
+		job.sink->blockCompressed(job.block, std::move(out));
+	}
+	if (m_compression == COMPRESSION_ZSTD) {
+		ZSTD_freeCCtx(zstdCtx);
+	} else if (ok) {
+		deflateEnd(&zs);
+	}
+}
+
+bool CompressionPool::compressGZIP(void *ctx, const vector<char> &block, vector<char> &out) {
+	z_stream *zs = (z_stream*)ctx;
+
+	// Each block is a gzip member of its own.
+	deflateReset(zs);
+	out.resize(deflateBound(zs, block.size()));
+	zs->next_in = (Bytef*)block.data();
+	zs->avail_in = block.size();
+	zs->next_out = (Bytef*)out.data();
+	zs->avail_out = out.size();
+	int ret = deflate(zs, Z_FINISH);
+	if (ret != Z_STREAM_END) {
+		cerr << "Cannot compress block: " << zError(ret) << endl;
+		return false;
+	}
+	out.resize(zs->total_out);
+	return true;
+}
+
+bool CompressionPool::compressZSTD(void *ctx, const vector<char> &block, vector<char> &out) {
+	ZSTD_CCtx *cctx = (ZSTD_CCtx*)ctx;
+
+	// Each block is a zstd frame of its own, which records its content size.
+	out.resize(ZSTD_compressBound(block.size()));
+	size_t ret = ZSTD_compress2(cctx, out.data(), out.size(), block.data(), block.size());
+	if (ZSTD_isError(ret)) {
+		cerr << "Cannot compress block: " << ZSTD_getErrorName(ret) << endl;
+		return false;
+	}
+	out.resize(ret);
+	return true;
+}
@@ -0,0 +1,73 @@
+#ifndef __COMPRESSIONPOOL_H__
+#define __COMPRESSIONPOOL_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "decompressreader.h"
+
+#define COMPRESSION_ZSTD_LEVEL		3				// zstd's default
+#define COMPRESSION_GZIP_LEVEL		6				// gzip's default
+
+/**
+ * Receives the blocks compressed by a CompressionPool.
+ */
+struct CompressedBlockSink {
+	virtual ~CompressedBlockSink() { }
+	/**
+	 * Called by a worker with the compressed {@param data} of the block numbered {@param block}.
+	 * {@param data} is empty if the compression failed.
+	 */
+	virtual void blockCompressed(size_t block, std::vector<char> &&data) = 0;
+};
+
+/**
+ * A pool of worker threads, which compresses independent blocks of the output files.
+ * Each block becomes a gzip member or a zstd frame of its own. Concatenated in order,
+ * they form a valid stream, which zcat, zstdcat, or convert itself can read.
+ * The pool is shared by all output files, and does not care about the order of the blocks.
+ * Restoring it is up to the submitter.
+ */
+struct CompressionPool {
+	/**
+	 * Use {@param threads} workers, or one per CPU if it is 0. {@param compression} is either COMPRESSION_GZIP or COMPRESSION_ZSTD.
+	 */
+	CompressionPool(enum COMPRESSION compression, unsigned threads);
+	/**
+	 * Compresses the blocks still queued, and stops the workers.
+	 */
+	~CompressionPool();
+	/**
+	 * Queues the block numbered {@param block}. A worker hands its compressed {@param data} to {@param sink}.
+	 */
+	void compress(CompressedBlockSink *sink, size_t block, std::vector<char> &&data);
+	unsigned threads() const {
+		return m_workers.size();
+	}
+	/**
+	 * The file name extension of the compressed files, e.g., ".gz".
+	 */
+	const char* extension() const;
+
+	private:
+	struct Job {
+		CompressedBlockSink *sink;
+		size_t block;
+		std::vector<char> data;
+	};
+
+	enum COMPRESSION m_compression;
+	std::deque<Job> m_jobs;
+	bool m_stop;												// Tells the workers to quit once the queue is empty
+	std::vector<std::thread> m_workers;
+	std::mutex m_lock;											// Protects m_jobs and m_stop
+	std::condition_variable m_jobReady;
+
+	void worker();
+	bool compressGZIP(void *ctx, const std::vector<char> &block, std::vector<char> &out);
+	bool compressZSTD(void *ctx, const std::vector<char> &block, std::vector<char> &out);
+};
+
+#endif // __COMPRESSIONPOOL_H__
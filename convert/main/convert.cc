@@ -4,11 +4,14 @@
 #include <cstdlib>
 #include <unistd.h>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <stack>
+#include <thread>
+#include <chrono>
 
 #include <bfd.h>
 #include <fcntl.h>
@@ -20,13 +23,22 @@
 #include "git_version.h"
 #include "rwlock.h"
 #include "lockmanager.h"
+#include "csvwriter.h"
+#include "columnfile.h"
+#include "compressionpool.h"
+#include "stacktracetable.h"
+#include "symboltable.h"
+#include "addressindex.h"
 
 #include "binaryread.h"
+#include "tracereader.h"
+#include "binarytrace.h"
+#include "parallelparser.h"
 #include "gzstream/gzstream.h"
 
 /**
  * Authors: Alexander Lochmann, Horst Schirmeier
- * Attention: This programm has to be compiled with -std=c++11 !
+ * Attention: This programm has to be compiled with -std=c++17 !
  * This program takes a csv as input, which contains a series of events.
  * Each event might be of the following types: alloc, free, p(acquire), v (release), read, or write.
  * The program groups the alloc and free events as well as the p and v events by their pointer, and assigns an unique id to each unique entitiy (allocation or lock).
@@ -83,20 +95,36 @@ struct MemAccess {
  * The kernel source tree
  */
 static const char *kernelBaseDir = "/opt/kernel/linux-32-lockdebugging-4-10/";
+/**
+ * The interned PSEUDOLOCK_VAR
+ */
+static SymbolID pseudoLockVar;
 
 static LockManager *lockManager;
+/**
+ * With -a, the accesses go to accesses.ldc in the column file format instead.
+ */
+static ColumnFileWriter *accessColumnFile;
 /**
  * Contains all active allocations. The ptr to the memory area is used as an index.
  */
-static map<unsigned long long,Allocation> activeAllocs;
+static AddressIndex<Allocation> activeAllocs;
 /**
  * Contains all observed datatypes.
  */
 static std::vector<DataType> types;
+/**
+ * Maps the name of a datatype to its index into the types array.
+ */
+static unordered_map<string, int> typeIndex;
 /**
  * Contains all observed subclasses.
  */
 static std::vector<Subclass> subclasses;
+/**
+ * Maps the name of a subclass to its index into the subclasses array.
+ */
+static unordered_map<string, int> subclassIndex;
 /**
  * The list of the LOOK_BEHIND_WINDOW last memory accesses.
  */
@@ -104,14 +132,17 @@ static vector<MemAccess> lastMemAccesses;
 /**
  * A map of all member names found in all data types.
  * The key is the name, and the value is a name's global id.
+ * The transparent comparator allows for looking up a C string without copying it.
+ */
+static map<string,unsigned long long,less<>> memberNames;
+/**
+ * All stacktraces found in all data types. Each one is identified by its instrptr and its return addresses.
  */
-static map<string,unsigned long long> memberNames;
+static StacktraceTable stacktraces;
 /**
- * A map of all stacktraces found in all data types.
- * The key is the first instrptr of a stacktrace, and the value is a map.
- * That map in turn maps the remaining stacktrace to a stacktrace's global id.
+ * If non-zero, the stacktraces are resolved after the whole trace has been read, on that many threads.
  */
-static map<unsigned long long, map<string,unsigned long long> > stacktraces;
+static unsigned resolveThreads;
 
 /**
  * Pairs of start addresses and sizees of the named data section
@@ -144,16 +175,13 @@ static unsigned long long curAccessID = 1;
  * The next id for a member name
  */
 static unsigned long long curMemberNameID = 1;
-/**
- * The next id for a stacktrace
- */
-static unsigned long long curStacktraceID = 1;
 
 char delimiter = DELIMITER_CHAR;
 
 static void printUsageAndExit(const char *elf) {
 	cerr << "usage: " << elf
-		<< " [options] -t path/to/data_types.csv -k path/to/vmlinux -b path/to/function_blacklist.csv -m path/to/member_blacklist.csv input.csv[.gz]\n\n"
+		<< " [options] -t path/to/data_types.csv -k path/to/vmlinux -b path/to/function_blacklist.csv -m path/to/member_blacklist.csv input.csv[.gz|.zst|.lz4]|-\n\n"
+		"The trace may be a FIFO, or - for stdin.\n\n"
 		"Options:\n"
 		" -s  enable processing of seqlock_t (EXPERIMENTAL)\n"
 		" -v  show version\n"
@@ -163,6 +191,22 @@ static void printUsageAndExit(const char *elf) {
 		"     (these will be assigned to a pseudo allocation with ID 1)\n"
 		" -g  The kernel source tree, default: " << kernelBaseDir << "\n"
 		" -c  Use one TXN stack per contex\n"
+		" -j  number of threads decompressing and parsing the trace, default: one per CPU\n"
+		" -l  write each distinct set of locks held during a TXN once to locksets.csv,\n"
+		"     and refer to it from txns.csv, instead of writing locks_held.csv\n"
+		" -p  together with -l, write locks_held.csv nevertheless, e.g., for the acquisition timestamps\n"
+		" -o  write the output files with O_DIRECT, bypassing the page cache\n"
+		" -w  write each output file on a thread of its own, and report how long each one stalled the processing\n"
+		" -f  write the tables in PostgreSQL's binary COPY format to *.pgcopy instead of CSV,\n"
+		"     except for structs_layout.csv\n"
+		" -z  compress the output files with gzip or zstd, e.g., -z zstd, in independent blocks on one thread per CPU\n"
+		" -n  split the accesses by their alloc_id into n files accesses.0.csv, ..., e.g., for a parallel import\n"
+		" -a  write the accesses to accesses.ldc in the LockDoc column format instead, see col2csv\n"
+		" -i  resolve the stacktraces with an index of the DWARF line tables built at startup, and with libbfd only\n"
+		"     if the index does not know an address (EXPERIMENTAL, may name some functions and files differently)\n"
+		" -r  resolve the stacktraces after the whole trace has been read, on r threads together with -i.\n"
+		"     libbfd is not thread-safe, and resolves the remaining addresses on one thread at a time\n"
+		" -q  keep the resolved stacktrace addresses in the given file, e.g., next to the vmlinux, for later runs against the same vmlinux\n"
 		" -h  help\n";
 	exit(EXIT_FAILURE);
 }
@@ -201,17 +245,16 @@ static void handlePV(
 	enum LOCK_OP lockOP,
 	unsigned long long ts,
 	unsigned long long lockAddress,
-	string const& file,
+	SymbolID file,
 	unsigned long long line,
-	string const& lockMember,
-	string const& lockType,
+	SymbolID lockMember,
+	SymbolID lockType,
 	unsigned flags,
 	bool includeAllLocks,
 	unsigned long long pseudoAllocID,
-	ofstream& locksOFile,
-	ofstream& txnsOFile,
-	ofstream& locksHeldOFile,
-	const char *kernelBaseDir,
+	CSVWriter& locksOFile,
+	CSVWriter& txnsOFile,
+	CSVWriter& locksHeldOFile,
 	long ctx
 	)
 {
@@ -222,16 +265,14 @@ static void handlePV(
 		const char *lockVarName = NULL;
 		// A lock which probably resides in one of the observed allocations. If not, check if it is a global lock
 		// This way, locks which reside in global structs are recognized as 'embedded in'.
-		auto itAlloc = activeAllocs.upper_bound(lockAddress);
-		if (itAlloc != activeAllocs.begin()) {
-			itAlloc--;
-			if (lockAddress < itAlloc->first + itAlloc->second.size) {
-				allocation_id = itAlloc->second.id;
-			}
+		uint64_t baseAddress;
+		const Allocation *alloc = activeAllocs.findPreceding(lockAddress, baseAddress);
+		if (alloc && lockAddress < baseAddress + alloc->size) {
+			allocation_id = alloc->id;
 		}
 		if (allocation_id == 0) {
 			if (checkLockInSections(lockAddress, dataSections)
-				|| (lockMember.compare(PSEUDOLOCK_VAR) == 0 && RWLock::isPseudoLock(lockAddress))) {
+				|| (lockMember == pseudoLockVar && RWLock::isPseudoLock(lockAddress))) {
 				// static lock which resides either in the bss segment or in the data segment
 				// or global static lock aka rcu lock
 				PRINT_DEBUG("ts=" << dec << ts << ",lockAddress=" << hex << showbase << lockAddress, "Found static lock.");
@@ -255,14 +296,15 @@ static void handlePV(
 		tempLock = lockManager->allocLock(lockAddress, allocation_id, lockType, lockVarName, flags);
 		PRINT_DEBUG("", "Created lock: " << tempLock);
 		// Write the lock to disk (aka locks.csv)
-		tempLock->writeLock(locksOFile, delimiter);
+		tempLock->writeLock(locksOFile);
 	}
-	tempLock->transition(lockOP, ts, file, line, lockMember, flags, kernelBaseDir, ctx);
+	tempLock->transition(lockOP, ts, file, line, lockMember, flags, ctx);
 }
 
-static void writeMemAccesses(char pAction, unsigned long long pAddress, ofstream *pMemAccessOFile, vector<MemAccess> *pMemAccesses) {
-	vector<MemAccess>::iterator itAccess;
-	MemAccess window[LOOK_BEHIND_WINDOW];
+/**
+ * With more than one file in {@param pMemAccessOFiles}, each access goes to the file its alloc_id modulo their number selects.
+ */
+static void writeMemAccesses(char pAction, unsigned long long pAddress, vector<CSVWriter> *pMemAccessOFiles, vector<MemAccess> *pMemAccesses) {
 	int size;
 
 	// Since we want to build up a history of the n last memory accesses, we do nothing if a r or w event is imminent.
@@ -274,8 +316,7 @@ static void writeMemAccesses(char pAction, unsigned long long pAddress, ofstream
 	    pMemAccesses->size() >= LOOK_BEHIND_WINDOW) {
 		size = pMemAccesses->size();
 		// Have a look at the two last events
-		window[0] = pMemAccesses->at(size - 2);
-		window[1] = pMemAccesses->at(size - 1);
+		const MemAccess *window = pMemAccesses->data() + size - LOOK_BEHIND_WINDOW;
 		// If they have the same timestamp, access the same address, access the same amount of memory, and one is a read and the other event is a write,
 		// they'll probably belong to the upcoming acquire or release events.
 		// To increase the certainty that both events belong to the lock operation, the read/write address is compared to the address of the lock.
@@ -304,24 +345,41 @@ static void writeMemAccesses(char pAction, unsigned long long pAddress, ofstream
 	// heuristic.
 
 	// write memory accesses to disk and associate them with the current TXN
-	for (auto&& tempAccess : *pMemAccesses) {
-		long ctx;
-		if (ctxTracing) {
-			ctx = tempAccess.ctx;
-		} else {
-			ctx = DUMMY_EXECUTION_CONTEXT;
+	if (pMemAccesses->empty()) {
+		return;
+	}
+	// The TXN stacks do not change during a flush. Hence, the active TXN is only resolved if the context changes.
+	long ctx = 0;
+	TXN *activeTXN = NULL;
+	bool resolved = false;
+	for (const auto& tempAccess : *pMemAccesses) {
+		long accessCtx = ctxTracing ? tempAccess.ctx : DUMMY_EXECUTION_CONTEXT;
+		if (!resolved || accessCtx != ctx) {
+			ctx = accessCtx;
+			activeTXN = lockManager->activeTXN(ctx);
+			resolved = true;
+		}
+		if (activeTXN) {
+			// count memory accesses for the current TXN
+			activeTXN->memAccessCounter += 1;
 		}
-		*pMemAccessOFile << dec << tempAccess.id << delimiter << tempAccess.alloc_id;
-		*pMemAccessOFile << delimiter << (lockManager->hasActiveTXN(ctx) ? std::to_string(lockManager->getActiveTXN(ctx).id) : "\\N");
-		*pMemAccessOFile << delimiter << tempAccess.ts;
-		*pMemAccessOFile << delimiter << tempAccess.action << delimiter << dec << tempAccess.size;
-		*pMemAccessOFile << delimiter << tempAccess.address << delimiter << tempAccess.stacktrace_id;
-		*pMemAccessOFile << delimiter << tempAccess.ctx;
-		*pMemAccessOFile << "\n";
-		// count memory accesses for the current TXN if there's one active
-		if (lockManager->hasActiveTXN(ctx)) {
-			lockManager->getActiveTXN(ctx).memAccessCounter += 1;
+		if (accessColumnFile) {
+			const uint64_t row[] = { tempAccess.id, tempAccess.alloc_id, activeTXN ? activeTXN->id : 0, tempAccess.ts,
+				(uint64_t)tempAccess.action, (uint64_t)tempAccess.size, tempAccess.address, tempAccess.stacktrace_id, (uint64_t)tempAccess.ctx };
+			accessColumnFile->addRow(row);
+			continue;
+		}
+		size_t shards = pMemAccessOFiles->size();
+		CSVWriter *pMemAccessOFile = &(*pMemAccessOFiles)[shards == 1 ? 0 : tempAccess.alloc_id % shards];
+		pMemAccessOFile->field(tempAccess.id).field(tempAccess.alloc_id);
+		if (activeTXN) {
+			pMemAccessOFile->field(activeTXN->id);
+		} else {
+			pMemAccessOFile->null();
 		}
+		pMemAccessOFile->field(tempAccess.ts).field(tempAccess.action);
+		pMemAccessOFile->field(tempAccess.size).field(tempAccess.address);
+		pMemAccessOFile->field(tempAccess.stacktrace_id).field(tempAccess.ctx).endRow();
 	}
 
 
@@ -335,111 +393,104 @@ static void writeMemAccesses(char pAction, unsigned long long pAddress, ofstream
 
 static bool expand_type(const char *struct_typename)
 {
-	return find_if(types.cbegin(), types.cend(),
-		[&struct_typename](const DataType& type) { return type.name == struct_typename; } )
-		!= types.cend();
+	return typeIndex.find(struct_typename) != typeIndex.end();
 }
 
 static unsigned long long addMemberName(const char *member_name) {
 	unsigned long long ret;
 
 	// Do we know that member name?
-	const auto it = find_if(memberNames.cbegin(), memberNames.cend(),
-		[&member_name](const pair<string, unsigned long long> &value ) { return value.first == member_name; } );
-	if (it == memberNames.cend()) {
+	auto it = memberNames.lower_bound(member_name);
+	if (it == memberNames.end() || it->first != member_name) {
 		ret = curMemberNameID++;
-		memberNames.emplace(member_name,ret);
+		memberNames.emplace_hint(it, member_name, ret);
 	} else {
 		ret = it->second;
 	}
 	return ret;
 }
 
-static unsigned long long addStacktrace(const char *kernelBaseDir, ostream &stacktracesOFile, char delimiter, unsigned long long instrPtr, std::string &stacktrace) {
-	unsigned long long ret;
-
-	// Remove the last character since it always is a comma.
-	if (!stacktrace.empty() && stacktrace.find_last_of(',') != string::npos) {
-		stacktrace.pop_back();
-	}
-	auto itStacktrace = stacktraces.emplace(instrPtr,map<std::string,unsigned long long>());
-	auto &subStacktraces = itStacktrace.first->second;
-	// Do we know that substacktrace?
-	const auto itSubStacktrace = find_if(subStacktraces.cbegin(), subStacktraces.cend(),
-		[&stacktrace](const pair<string, unsigned long long> &value ) { return value.first == stacktrace; } );
-	if (itSubStacktrace == subStacktraces.cend()) {
-		int sequence = 0;
-		stringstream ss;
-		ss << hex << showbase << instrPtr;
-		if (!stacktrace.empty()) {
-		       ss << "," << stacktrace;
+static void writeStacktrace(const char *kernelBaseDir, CSVWriter &stacktracesOFile, unsigned long long id, const uint64_t *frames, size_t length) {
+	int sequence = 0;
+	for (size_t i = 0; i < length; i++) {
+		auto instrPtr = frames[i], instrPtrPrev = frames[i];
+		if (sequence > 0) {
+			instrPtrPrev--;
 		}
-		std::string token;
-
-		ret = curStacktraceID++;
-		subStacktraces.emplace(stacktrace,ret);
-
-		while (getline(ss,token,',')) {
-			auto instrPtrPrev = instrPtr = std::stoull(token,NULL,16);
-			if (sequence > 0) {
-				instrPtrPrev--;
-			}
-			const struct ResolvedInstructionPtr &resolvedInstrPtr = get_function_at_addr(kernelBaseDir, instrPtrPrev);
-			stacktracesOFile << ret << delimiter << sequence << delimiter << instrPtr << delimiter << instrPtrPrev << delimiter;
-			stacktracesOFile << resolvedInstrPtr.codeLocation.fn << delimiter << resolvedInstrPtr.codeLocation.line << delimiter << resolvedInstrPtr.codeLocation.file << "\n";
-			sequence++;
-			if (resolvedInstrPtr.inlinedBy.size() > 0) {
-				for (auto &inlinedFn : resolvedInstrPtr.inlinedBy) {
-					stacktracesOFile << ret << delimiter << sequence << delimiter << instrPtr << delimiter << instrPtrPrev << delimiter;
-					stacktracesOFile << inlinedFn.fn << delimiter << inlinedFn.line << delimiter << inlinedFn.file << "\n";
-					sequence++;
-				}
+		const struct ResolvedInstructionPtr &resolvedInstrPtr = get_function_at_addr(kernelBaseDir, instrPtrPrev);
+		stacktracesOFile.field(id).field(sequence).field(instrPtr).field(instrPtrPrev);
+		stacktracesOFile.field(resolvedInstrPtr.codeLocation.fn).field(resolvedInstrPtr.codeLocation.line).field(resolvedInstrPtr.codeLocation.file).endRow();
+		sequence++;
+		if (resolvedInstrPtr.inlinedBy.size() > 0) {
+			for (auto &inlinedFn : resolvedInstrPtr.inlinedBy) {
+				stacktracesOFile.field(id).field(sequence).field(instrPtr).field(instrPtrPrev);
+				stacktracesOFile.field(inlinedFn.fn).field(inlinedFn.line).field(inlinedFn.file).endRow();
+				sequence++;
 			}
 		}
-	} else {
-		ret = itSubStacktrace->second;
 	}
-	return ret;
 }
 
-static int isGZIPFile(const char *filename) {
-	int fd, bytes;
-	unsigned char buffer[2];
+static unsigned long long addStacktrace(const char *kernelBaseDir, CSVWriter &stacktracesOFile, unsigned long long instrPtr, string_view stacktrace) {
+	bool added;
+	unsigned long long ret = stacktraces.intern(instrPtr, stacktrace, added);
 
-	fd = open(filename,O_RDONLY);
-	if (fd < 0) {
-		perror("isGZIPFile()->open");
-		return -1;
+	// Deferred stacktraces are written by writeDeferredStacktraces()
+	if (added && resolveThreads == 0) {
+		const vector<uint64_t> &frames = stacktraces.frames();
+		writeStacktrace(kernelBaseDir, stacktracesOFile, ret, frames.data(), frames.size());
 	}
-	bytes = read(fd,buffer,2);
-	if (bytes < 0) {
-		perror("isGZIPFile()->read");
-		return -1;
-	} else if (bytes != 2) {
-		return -1;
+	return ret;
+}
+
+/**
+ * Resolves the distinct instruction pointers of all stacktraces at once, and writes the stacktraces in the order of their IDs,
+ * i.e., like addStacktrace() does inline.
+ */
+static void writeDeferredStacktraces(const char *kernelBaseDir, CSVWriter &stacktracesOFile) {
+	vector<uint64_t> addrs;
+	const uint64_t *frames;
+	size_t length;
+
+	auto start = chrono::steady_clock::now();
+	for (unsigned long long id = 1; id <= stacktraces.size(); id++) {
+		frames = stacktraces.frames(id, length);
+		for (size_t i = 0; i < length; i++) {
+			// Return addresses are resolved to the call instruction
+			addrs.push_back(i > 0 ? frames[i] - 1 : frames[i]);
+		}
 	}
-	close(fd);
-	if (buffer[0] == 0x1f && buffer[1] == 0x8b) {
-		return 1;
-	} else {
-		return 0;
+	sort(addrs.begin(), addrs.end());
+	addrs.erase(unique(addrs.begin(), addrs.end()), addrs.end());
+	unsigned threads = resolve_addrs(kernelBaseDir, addrs, resolveThreads);
+	cerr << "Resolved " << dec << addrs.size() << " instruction pointers on " << threads << " threads in "
+		<< chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() << "ms" << endl;
+
+	for (unsigned long long id = 1; id <= stacktraces.size(); id++) {
+		frames = stacktraces.frames(id, length);
+		writeStacktrace(kernelBaseDir, stacktracesOFile, id, frames, length);
 	}
 }
 
 int main(int argc, char *argv[]) {
 	stringstream ss;
-	string inputLine, token, typeStr, file, lockType, stacktrace, lockMember;
-	vector<string> lineElems; // input CSV columns
-	map<unsigned long long,Allocation>::iterator itAlloc;
-	unsigned long long ts = 0, address = 0x1337, size = 4711, line = 1337, baseAddress = 0x4711, instrPtr = 0xc0ffee, flags = 0x4712;
-	int lineCounter, isGZ, param;
-	char action = '.', *vmlinuxName = NULL, *fnBlacklistName = nullptr, *memberBlacklistName = nullptr, *datatypesName = nullptr;
-	bool processSeqlock = false, includeAllLocks = false;
-	enum LOCK_OP lockOP = P_WRITE;
+	string inputLine, token;
+	string_view traceLine, typeStr;
+	vector<string> lineElems; // blacklist CSV columns
+	TraceEvent event;
+	Allocation *alloc;
+	unsigned long long ts = 0, address = 0x1337, size = 4711, baseAddress = 0x4711;
+	unsigned long long lineCounter;
+	int param;
+	unsigned threads = 0;
+	enum COMPRESSION outputCompression = COMPRESSION_NONE;
+	int accessShards = 1;
+	char action = '.', *vmlinuxName = NULL, *fnBlacklistName = nullptr, *memberBlacklistName = nullptr, *datatypesName = nullptr, *symbolCacheName = nullptr;
+	bool processSeqlock = false, includeAllLocks = false, writeLocksets = false, writeLocksHeld = false, directIO = false, asyncWriters = false, binaryCopy = false, columnAccesses = false, useLineIndex = false;
 	long ctx = 0;
 	unsigned long long pseudoAllocID = 0; // allocID for locks belonging to unknown allocation
 
-	while ((param = getopt(argc,argv,"k:b:m:t:svhd:ug:c")) != -1) {
+	while ((param = getopt(argc,argv,"k:b:m:t:svhd:ug:cj:lpowfaz:n:ir:q:")) != -1) {
 		switch (param) {
 		case 'c':
 			ctxTracing = 1;
@@ -473,11 +524,60 @@ int main(int argc, char *argv[]) {
 		case 'g':
 			kernelBaseDir = optarg;
 			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'l':
+			writeLocksets = true;
+			break;
+		case 'p':
+			writeLocksHeld = true;
+			break;
+		case 'o':
+			directIO = true;
+			break;
+		case 'w':
+			asyncWriters = true;
+			break;
+		case 'f':
+			binaryCopy = true;
+			break;
+		case 'a':
+			columnAccesses = true;
+			break;
+		case 'i':
+			useLineIndex = true;
+			break;
+		case 'r':
+			resolveThreads = atoi(optarg);
+			break;
+		case 'q':
+			symbolCacheName = optarg;
+			break;
+		case 'n':
+			accessShards = atoi(optarg);
+			break;
+		case 'z':
+			if (string(optarg) == "gzip") {
+				outputCompression = COMPRESSION_GZIP;
+			} else if (string(optarg) == "zstd") {
+				outputCompression = COMPRESSION_ZSTD;
+			} else {
+				cerr << "Unknown compression: " << optarg << endl;
+				printUsageAndExit(argv[0]);
+			}
+			break;
 		}
 	}
 	if (!vmlinuxName || !fnBlacklistName || ! memberBlacklistName || !datatypesName || optind == argc) {
 		printUsageAndExit(argv[0]);
 	}
+	if (accessShards < 1 || (accessShards > 1 && columnAccesses)) {
+		cerr << "-n needs a positive number of files, and cannot be combined with -a" << endl;
+		printUsageAndExit(argv[0]);
+	}
+	symbols.setKernelDir(kernelBaseDir);
+	pseudoLockVar = symbols.intern(PSEUDOLOCK_VAR);
 
 	printVersion();
 	if (processSeqlock) {
@@ -498,12 +598,17 @@ int main(int argc, char *argv[]) {
 			continue;
 		}
 		types.emplace_back(curTypeID++, inputLine);
+		// Like a linear search, the index refers to the first datatype of a given name.
+		typeIndex.emplace(inputLine, types.size() - 1);
 	}
 
-	if (binaryread_init(vmlinuxName)) {
+	if (binaryread_init(vmlinuxName, useLineIndex)) {
 		cerr << "Cannot init binaryread" << endl;
 		return EXIT_FAILURE;
 	}
+	if (symbolCacheName) {
+		binaryread_load_cache(symbolCacheName, kernelBaseDir);
+	}
 
 	// Examine Kernel ELF: retrieve .bss, .data and other, optional segment locations
 	readSections(dataSections);
@@ -518,35 +623,29 @@ int main(int argc, char *argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	// This is very bad design practise!
-	// Only the fstream does have a close() method.
-	// Since the gzstream is a direct subclass of iostream, a ptr of that type
-	// cannot be stored in one common ptr variable without losing the
-	// ability to call close().
-	istream *infile;
-	igzstream *gzinfile = NULL;
-	ifstream *rawinfile = NULL;
+	if (threads == 0) {
+		threads = max(1U, thread::hardware_concurrency());
+	}
 	char *fname = argv[optind];
-	isGZ = isGZIPFile(fname);
-
-	if (isGZ == 1) {
-		gzinfile = new igzstream(fname);
-		if (!gzinfile->is_open()) {
-			cerr << "Cannot open file: " << fname << endl;
-			return EXIT_FAILURE;
-		}
-		infile = gzinfile;
-	} else if (isGZ == 0) {
-		rawinfile = new ifstream(fname);
-		if (!rawinfile->is_open()) {
-			cerr << "Cannot open file: " << fname << endl;
-			return EXIT_FAILURE;
-		}
-		infile = rawinfile;
-	} else {
+	TraceReader *traceReader = openTraceReader(fname, threads);
+	BinaryTraceDecoder *binaryDecoder = NULL;
+	ParallelCSVParser *csvParser = NULL;
+	if (traceReader == NULL) {
 		cerr << "Cannot read inputfile: " << fname << endl;
 		return EXIT_FAILURE;
 	}
+	if (isBinaryTrace(traceReader)) {
+		// A binary trace, e.g., written by csv2bin. It does not need to be parsed at all.
+		binaryDecoder = new BinaryTraceDecoder(traceReader);
+		if (!binaryDecoder->readHeader()) {
+			return EXIT_FAILURE;
+		}
+		cerr << "Reading binary trace" << endl;
+	} else if (threads > 1) {
+		// Only applying the events has to be done sequentially. Parsing them is done in parallel.
+		csvParser = new ParallelCSVParser(traceReader, delimiter, ctxTracing, threads);
+		cerr << "Parsing with " << threads << " threads" << endl;
+	}
 
 	ifstream fnBlacklistInfile(fnBlacklistName);
 	if (!fnBlacklistInfile.is_open()) {
@@ -560,184 +659,178 @@ int main(int argc, char *argv[]) {
 	}
 
 	// Create the outputfiles. One for each table.
-	ofstream datatypesOFile("data_types.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream allocOFile("allocations.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream accessOFile("accesses.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream locksOFile("locks.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream locksHeldOFile("locks_held.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream txnsOFile("txns.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream fnblacklistOFile("function_blacklist.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream memberblacklistOFile("member_blacklist.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream membernamesOFile("member_names.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream stacktracesOFile("stacktraces.csv",std::ofstream::out | std::ofstream::trunc);
-	ofstream subclassesOFile("subclasses.csv", std::ofstream::out | std::ofstream::trunc);
-
-	// CSV headers
-	datatypesOFile << "id" << delimiter << "name" << endl;
-
-	allocOFile << "id" << delimiter << "subclass_id" << delimiter << "base_address" << delimiter;
-	allocOFile << "size" << delimiter << "start" << delimiter << "end" << endl;
-
-	accessOFile << "id" << delimiter << "alloc_id" << delimiter << "txn_id" << delimiter;
-	accessOFile << "ts" << delimiter;
-	accessOFile << "type" << delimiter << "size" << delimiter << "address" << delimiter;
-	accessOFile << "stacktrace_id" << delimiter << "fn" << delimiter;
-	accessOFile << "context" << endl;
-
-	locksOFile << "id" << delimiter << "address" << delimiter;
-	locksOFile << "embedded_in" << delimiter << "lock_type_name" << delimiter;
-	locksOFile << "sub_lock" << delimiter << "lock_var_name" << delimiter;
-	locksOFile << "flags" << endl;
-
-	locksHeldOFile << "txn_id" << delimiter << "lock_id" << delimiter;
-	locksHeldOFile << "start" << delimiter;
-	locksHeldOFile << "last_file" << delimiter << "last_line" << endl;
-
-	txnsOFile << "id" << delimiter << "start_ts" << delimiter;
-	txnsOFile << "start_ctx" << delimiter << "end_ts" << delimiter;
-	txnsOFile << "end_ctx" << endl;
-
-	fnblacklistOFile << "id" << delimiter << "subclass_id" << delimiter << "member_name_id"
-		<< delimiter << "fn" << endl;
-
-	memberblacklistOFile << "subclass_id" << delimiter << "member_name_id" << endl;
-		
-	membernamesOFile << "id" << delimiter << "member_name" << endl;
-	
-	stacktracesOFile << "id" << delimiter << "sequence" << delimiter << "instruction_ptr" << delimiter;
-	stacktracesOFile << "instruction_ptr_prev" << delimiter << "function" << delimiter << "line" << delimiter << "file" << endl;
+	CSVWriter datatypesOFile, allocOFile, locksOFile, locksHeldOFile, locksetsOFile, txnsOFile;
+	CSVWriter fnblacklistOFile, memberblacklistOFile, membernamesOFile, stacktracesOFile, subclassesOFile;
+	vector<CSVWriter> accessOFiles(accessShards);
+	// Without -l, every held lock of each TXN goes to locks_held.csv
+	writeLocksHeld = writeLocksHeld || !writeLocksets;
+	CompressionPool *compressor = NULL;
+	if (outputCompression != COMPRESSION_NONE) {
+		// Every block is compressed independently. Hence, one pool serves all output files.
+		compressor = new CompressionPool(outputCompression, 0);
+	}
+	const CSVWriterOptions writerOptions = { delimiter, binaryCopy, directIO, asyncWriters, compressor };
+	struct OutputFile {
+		CSVWriter *oFile;
+		string table;											// The file name without its extension
+		bool enabled;
+	};
+	vector<OutputFile> outputFiles = {
+		{ &datatypesOFile, "data_types", true },
+		{ &allocOFile, "allocations", true },
+		{ &locksOFile, "locks", true },
+		{ &locksHeldOFile, "locks_held", writeLocksHeld },
+		{ &locksetsOFile, "locksets", writeLocksets },
+		{ &txnsOFile, "txns", true },
+		{ &fnblacklistOFile, "function_blacklist", true },
+		{ &memberblacklistOFile, "member_blacklist", true },
+		{ &membernamesOFile, "member_names", true },
+		{ &stacktracesOFile, "stacktraces", true },
+		{ &subclassesOFile, "subclasses", true },
+	};
+	// The database does not care about the name of a file. The part up to the first dot names the table.
+	for (int i = 0; i < accessShards; i++) {
+		outputFiles.push_back({ &accessOFiles[i], accessShards > 1 ? "accesses." + to_string(i) : "accesses", !columnAccesses });
+	}
+	string outputExtension = binaryCopy ? ".pgcopy" : ".csv";
+	if (compressor) {
+		outputExtension += compressor->extension();
+	}
+	for (const auto &outputFile : outputFiles) {
+		string fname = outputFile.table + outputExtension;
+		if (outputFile.enabled && !outputFile.oFile->open(fname.c_str(), writerOptions)) {
+			cerr << "Cannot open file: " << fname << endl;
+			return EXIT_FAILURE;
+		}
+	}
+	ofstream accessColumnOFile;
+	if (columnAccesses) {
+		accessColumnOFile.open("accesses.ldc", std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+		if (!accessColumnOFile.is_open()) {
+			cerr << "Cannot open file: accesses.ldc" << endl;
+			return EXIT_FAILURE;
+		}
+		accessColumnFile = new ColumnFileWriter(accessColumnOFile, {
+			{ "id", COLUMN_FILE_UNSIGNED }, { "alloc_id", COLUMN_FILE_UNSIGNED }, { "txn_id", COLUMN_FILE_ID },
+			{ "ts", COLUMN_FILE_UNSIGNED }, { "type", COLUMN_FILE_CHAR }, { "size", COLUMN_FILE_UNSIGNED },
+			{ "address", COLUMN_FILE_UNSIGNED }, { "stacktrace_id", COLUMN_FILE_UNSIGNED }, { "context", COLUMN_FILE_SIGNED } });
+	}
+
+	// Table headers. The binary COPY format needs the column types of queries/db-scheme.sql.
+	// The CSV headers of accesses and function_blacklist have never matched their columns.
+	datatypesOFile.header({ "id", "name" }, { COLUMN_INT4, COLUMN_TEXT });
+
+	allocOFile.header({ "id", "subclass_id", "base_address", "size", "start", "end" },
+		{ COLUMN_INT4, COLUMN_INT4, COLUMN_INT8, COLUMN_INT4, COLUMN_INT8, COLUMN_INT8 });
+
+	for (auto &accessOFile : accessOFiles) {
+		if (accessOFile.isOpen()) {
+			accessOFile.header({ "id", "alloc_id", "txn_id", "ts", "type", "size", "address", "stacktrace_id", "fn", "context" },
+				{ COLUMN_INT8, COLUMN_INT4, COLUMN_INT4, COLUMN_INT8, COLUMN_TEXT, COLUMN_INT2, COLUMN_INT8, COLUMN_INT4, COLUMN_INT4 });
+		}
+	}
+
+	locksOFile.header({ "id", "address", "embedded_in", "lock_type_name", "sub_lock", "lock_var_name", "flags" },
+		{ COLUMN_INT4, COLUMN_INT8, COLUMN_INT4, COLUMN_TEXT, COLUMN_TEXT, COLUMN_TEXT, COLUMN_INT4 });
+
+	if (writeLocksHeld) {
+		locksHeldOFile.header({ "txn_id", "lock_id", "start", "last_file", "last_line" },
+			{ COLUMN_INT4, COLUMN_INT4, COLUMN_INT8, COLUMN_TEXT, COLUMN_INT4 });
+	}
+
+	if (writeLocksets) {
+		locksetsOFile.header({ "id", "lock_id" }, { COLUMN_INT4, COLUMN_INT4 });
+	}
 
-	subclassesOFile << "id" << delimiter << "data_type_id" << delimiter << "name" << endl;
+	vector<const char*> txnsColumns = { "id", "start_ts", "start_ctx", "end_ts", "end_ctx" };
+	vector<enum COLUMN_TYPE> txnsTypes = { COLUMN_INT4, COLUMN_INT8, COLUMN_INT8, COLUMN_INT8, COLUMN_INT8 };
+	if (writeLocksets) {
+		txnsColumns.push_back("lockset_id");
+		txnsTypes.push_back(COLUMN_INT4);
+	}
+	txnsOFile.header(txnsColumns, txnsTypes);
+
+	fnblacklistOFile.header({ "id", "subclass_id", "member_name_id", "fn" },
+		{ COLUMN_INT4, COLUMN_INT4, COLUMN_INT4, COLUMN_TEXT, COLUMN_INT4 });
+
+	memberblacklistOFile.header({ "subclass_id", "member_name_id" }, { COLUMN_INT4, COLUMN_INT4 });
+
+	membernamesOFile.header({ "id", "member_name" }, { COLUMN_INT4, COLUMN_TEXT });
+
+	stacktracesOFile.header({ "id", "sequence", "instruction_ptr", "instruction_ptr_prev", "function", "line", "file" },
+		{ COLUMN_INT4, COLUMN_INT4, COLUMN_INT8, COLUMN_INT8, COLUMN_TEXT, COLUMN_INT4, COLUMN_TEXT });
 
-	lockManager = new LockManager(txnsOFile, locksHeldOFile);
+	subclassesOFile.header({ "id", "data_type_id", "name" }, { COLUMN_INT4, COLUMN_INT4, COLUMN_TEXT });
+
+	lockManager = new LockManager(txnsOFile, writeLocksHeld ? &locksHeldOFile : NULL, writeLocksets ? &locksetsOFile : NULL);
 
 	for (const auto& type : types) {
-		datatypesOFile << type.id << delimiter << type.name << endl;
+		datatypesOFile.field(type.id).field(type.name).endRow();
 	}
 	
 	for (const auto& memberName : memberNames) {
-		membernamesOFile << memberName.second << delimiter << memberName.first << endl;
+		membernamesOFile.field(memberName.second).field(memberName.first).endRow();
 	}
 
 	if (includeAllLocks) {
 		// create pseudo alloc for locks we don't know the alloc they belong to
 		pseudoAllocID = curAllocID++;
-		allocOFile << pseudoAllocID << delimiter << 0 << delimiter << 0 << delimiter;
-		allocOFile << 0 << delimiter << 0 << delimiter << "\\N" << "\n";
+		allocOFile.field(pseudoAllocID).field(0).field(0);
+		allocOFile.field(0).field(0).null().endRow();
 	}
 
 	// Start reading the inputfile
-	for (lineCounter = 0;
-		getline(*infile,inputLine);
-		ss.clear(), ss.str(""), lineElems.clear(), lineCounter++) {
+	for (lineCounter = 0;; lineCounter++) {
 #ifdef DEBUG_DATASTRUCTURE_GROWTH
 		if ((lineCounter % 100000) == 0) {
-			cerr << lockPrimKey.size() << " "
-				<< activeAllocs.size() << " "
-				<< lastMemAccesses.size() << " "
-				<< functionAddresses.size() << " "
-				<< lineElems.size() << " "
-				<< ss.str().size() << std::endl;
+			cerr << activeAllocs.size() << " "
+				<< lastMemAccesses.size() << std::endl;
 		}
 #endif
-		// Skip the header if there is one.  This check exploits the fact that
-		// any valid input line must start with a decimal digit.
-		if (lineCounter == 0) {
-			if (inputLine.length() == 0 || !isdigit(inputLine[0])) {
-				continue;
-			} else {
-				cerr << "Warning: Input data does not start with a CSV header." << endl;
+		if (binaryDecoder) {
+			if (!binaryDecoder->nextEvent(event, ctxTracing)) {
+				break;
 			}
-		}
-	
-		ss << inputLine;
-		// Tokenize each line by delimiter, and store each element in a vector
-		while (getline(ss,token,delimiter)) {
-			lineElems.push_back(token);
-		}
-
-		// Parse each element
-		ts = std::stoull(lineElems.at(0));
-		if (lineElems.size() != MAX_COLUMNS) {
-			cerr << "Line (ts=" << ts << ") contains " << lineElems.size() << " elements. Expected " << MAX_COLUMNS << "." << endl;
-			return EXIT_FAILURE;
-		}
-		address = 0x1337, size = 4711, line = 1337, baseAddress = 0x4711, instrPtr = 0xc0ffee, flags = 0x4712;
-		lockType = file = stacktrace = "empty";
-		try {
-			action = lineElems.at(1).at(0);
-			switch (action) {
-			case LOCKDOC_ALLOC:
-			case LOCKDOC_FREE:
-				{
-					typeStr = lineElems.at(6);
-					baseAddress = std::stoull(lineElems.at(3),NULL,16);
-					size = std::stoull(lineElems.at(4));
-					break;
-				}
-			case LOCKDOC_LOCK_OP:
-				{
-					int temp;
-					address = std::stoull(lineElems.at(3),NULL,16);
-					lockMember = lineElems.at(7);
-					file = lineElems.at(8);
-					line = std::stoull(lineElems.at(9));
-					lockType = lineElems.at(6);
-					flags = std::stoi(lineElems.at(12),NULL,10);
-					if (ctxTracing) {
-						ctx = std::stoul(lineElems.at(13),NULL,10);
-					} else {
-						ctx = DUMMY_EXECUTION_CONTEXT;
-					}
-					temp = std::stoi(lineElems.at(2),NULL,10);
-					switch(temp) {
-						case P_READ:
-							lockOP = P_READ;
-							break;
-
-						case P_WRITE:
-							lockOP = P_WRITE;
-							break;
-
-						case V_READ:
-							lockOP = V_READ;
-							break;
-
-						case V_WRITE:
-							lockOP = V_WRITE;
-							break;
-
-						default:
-							cerr << "Line (ts=" << ts << ") contains invalid value for lock_op" << endl;
-							return EXIT_FAILURE;
-					}
-					break;
+		} else if (csvParser) {
+			if (!csvParser->nextEvent(event)) {
+				if (csvParser->failed()) {
+					return EXIT_FAILURE;
 				}
-			case LOCKDOC_READ:
-			case LOCKDOC_WRITE:
-				{
-					address = std::stoull(lineElems.at(3),NULL,16);
-					size = std::stoull(lineElems.at(4));
-					baseAddress = std::stoull(lineElems.at(5),NULL,16);
-					instrPtr = std::stoull(lineElems.at(10),NULL,16);
-					stacktrace = lineElems.at(11);
-					ctx = std::stoul(lineElems.at(13),NULL,10);
-					break;
+				break;
+			}
+		} else {
+			if (!traceReader->nextLine(traceLine)) {
+				break;
+			}
+			// Skip the header if there is one.  This check exploits the fact that
+			// any valid input line must start with a decimal digit.
+			if (lineCounter == 0) {
+				if (traceLine.length() == 0 || !isdigit(traceLine[0])) {
+					continue;
+				} else {
+					cerr << "Warning: Input data does not start with a CSV header." << endl;
 				}
 			}
-		} catch (exception &e) {
-			cerr << "Exception occurred (ts="<< ts << "): " << e.what() << endl;
+			if (!parseCSVEvent(traceLine, delimiter, ctxTracing, event, cerr)) {
+				return EXIT_FAILURE;
+			}
 		}
+		ts = event.ts;
+		action = event.action;
+		ctx = event.ctx;
 
-		if (!processSeqlock && (lockType.compare("seqlock_t") == 0 || lockType.compare("seqcount_t") == 0)) {
+		if (!processSeqlock && action == LOCKDOC_LOCK_OP && (event.type == "seqlock_t" || event.type == "seqcount_t")) {
 			continue;
 		}
 
-		writeMemAccesses(action, address, &accessOFile, &lastMemAccesses);
+		writeMemAccesses(action, event.address, &accessOFiles, &lastMemAccesses);
 		switch (action) {
 		case LOCKDOC_ALLOC:
 				{
-				if (activeAllocs.find(baseAddress) != activeAllocs.end()) {
+				baseAddress = event.address;
+				size = event.size;
+				typeStr = event.type;
+				if (activeAllocs.find(baseAddress)) {
 					PRINT_ERROR("ts=" << ts << ",baseAddress=" << hex << showbase << baseAddress << noshowbase,"Found active allocation at address.");
 					continue;
 				}
@@ -763,13 +856,11 @@ int main(int argc, char *argv[]) {
 				}
 				int subclass_idx;
 				// Do we know that subclass?
-				const auto itSubclass = find_if(subclasses.cbegin(), subclasses.cend(),
-					[&subclassName](const Subclass& subclass) { return subclass.name == subclassName; } );
-				if (itSubclass == subclasses.cend()) {
+				const auto itSubclass = subclassIndex.find(subclassName);
+				if (itSubclass == subclassIndex.end()) {
 					// Do we know that data type?
-					auto itDataType = find_if(types.begin(), types.end(),
-						[&dataTypeName](const DataType& type) { return type.name == dataTypeName; } );
-					if (itDataType == types.cend()) {
+					const auto itDataType = typeIndex.find(dataTypeName);
+					if (itDataType == typeIndex.end()) {
 						PRINT_ERROR("ts=" << ts,"Found unknown datatype: " << typeStr);
 						continue;
 					}
@@ -779,26 +870,25 @@ int main(int argc, char *argv[]) {
 					 * or no memory operations does it.
 					 * Mixing it up is not allowed!
 					 */
-					const auto itSubclass_ = find_if(subclasses.cbegin(), subclasses.cend(),
-						[&dataTypeName](const Subclass& subclass) { return subclass.name == dataTypeName; } );
-					if (itSubclass_ != subclasses.cend()) {
+					if (subclassIndex.find(dataTypeName) != subclassIndex.end()) {
 						PRINT_ERROR("ts=" << ts,"Found dummy subclass, although dedicated subclass exists: " << typeStr);
 						exit(-1);
 					}
-					int data_type_idx = itDataType - types.cbegin();
+					int data_type_idx = itDataType->second;
 					subclasses.emplace_back(curSubclassID++, subclassName, data_type_idx, realSubclass);
 					subclass_idx = subclasses.size() - 1;
+					subclassIndex.emplace(subclassName, subclass_idx);
 					PRINT_DEBUG("subclass=\"" << subclasses[subclass_idx].name << "\",data_type=\"" << types[data_type_idx].name << "\",idx=" << subclass_idx << ",real_subclass=" << realSubclass, "Created subclass");
 				} else {
-					subclass_idx = itSubclass - subclasses.cbegin();
+					subclass_idx = itSubclass->second;
 				}
 				// Remember that allocation
-				pair<map<unsigned long long,Allocation>::iterator,bool> retAlloc =
-					activeAllocs.insert(pair<unsigned long long,Allocation>(baseAddress,Allocation()));
-				if (!retAlloc.second) {
+				alloc = activeAllocs.insert(baseAddress);
+				if (!alloc) {
 					PRINT_ERROR("ts=" << ts << ",baseAddress=" << hex << showbase << baseAddress << noshowbase,"Cannot insert allocation into map.");
+					continue;
 				}
-				Allocation& tempAlloc = retAlloc.first->second;
+				Allocation& tempAlloc = *alloc;
 				tempAlloc.id = curAllocID++;
 				tempAlloc.start = ts;
 				tempAlloc.subclass_idx = subclass_idx;
@@ -808,36 +898,43 @@ int main(int argc, char *argv[]) {
 				}
 		case LOCKDOC_FREE:
 				{
-				itAlloc = activeAllocs.find(baseAddress);
-				if (itAlloc == activeAllocs.end()) {
+				baseAddress = event.address;
+				size = event.size;
+				typeStr = event.type;
+				alloc = activeAllocs.find(baseAddress);
+				if (!alloc) {
 					PRINT_ERROR("ts=" << ts << ",baseAddress=" << hex << showbase << baseAddress << noshowbase, "Didn't find active allocation for address.");
 					continue;
 				}
-				Allocation& tempAlloc = itAlloc->second;
+				Allocation& tempAlloc = *alloc;
 				// An allocations datatype is
-				allocOFile << tempAlloc.id << delimiter << subclasses[tempAlloc.subclass_idx].id << delimiter << baseAddress << delimiter << dec << size << delimiter << dec << tempAlloc.start << delimiter << ts << "\n";
-				lockManager->deleteLockByArea(itAlloc->first, tempAlloc.size);
+				allocOFile.field(tempAlloc.id).field(subclasses[tempAlloc.subclass_idx].id).field(baseAddress).field(size).field(tempAlloc.start).field(ts).endRow();
+				lockManager->deleteLockByArea(baseAddress, tempAlloc.size);
 
-				activeAllocs.erase(itAlloc);
+				activeAllocs.erase(baseAddress);
 				PRINT_DEBUG("baseAddress=" << showbase << hex << baseAddress << noshowbase << dec << ",type=" << typeStr << ",size=" << size, "Removed allocation");
 				break;
 				}
 		case LOCKDOC_LOCK_OP:
-			handlePV(lockOP, ts, address, file, line, lockMember, lockType,
-				flags, includeAllLocks, pseudoAllocID, locksOFile, txnsOFile, locksHeldOFile, kernelBaseDir, ctx);
+			handlePV(event.lockOP, ts, event.address, symbols.internFile(event.file), event.line,
+				symbols.intern(event.lockMember), symbols.intern(event.type),
+				event.flags, includeAllLocks, pseudoAllocID, locksOFile, txnsOFile, locksHeldOFile, ctx);
 			break;
 		case LOCKDOC_READ:
 		case LOCKDOC_WRITE:
 				{
-				itAlloc = activeAllocs.find(baseAddress);
-				if (itAlloc == activeAllocs.end()) {
+				address = event.address;
+				size = event.size;
+				baseAddress = event.baseAddress;
+				alloc = activeAllocs.find(baseAddress);
+				if (!alloc) {
 					PRINT_ERROR("ts=" << ts << ",baseAddress=" << hex << showbase << baseAddress << noshowbase, "Didn't find active allocation");
 					continue;
 				}
 				// sanity check
-				if (address < baseAddress || address > (baseAddress + itAlloc->second.size)
-					|| (address + size) < baseAddress || (address + size) > (baseAddress + itAlloc->second.size)) {
-					PRINT_ERROR("ts=" << ts << ",baseAddress=" << hex << showbase << baseAddress << noshowbase, "Memory-access address " << showbase << hex << address << " does not belong to indicated allocation, size=" << itAlloc->second.size << ",asize=" << size);
+				if (address < baseAddress || address > (baseAddress + alloc->size)
+					|| (address + size) < baseAddress || (address + size) > (baseAddress + alloc->size)) {
+					PRINT_ERROR("ts=" << ts << ",baseAddress=" << hex << showbase << baseAddress << noshowbase, "Memory-access address " << showbase << hex << address << " does not belong to indicated allocation, size=" << alloc->size << ",asize=" << size);
 					return EXIT_FAILURE;
 				}
 
@@ -845,12 +942,12 @@ int main(int argc, char *argv[]) {
 				MemAccess& tempAccess = lastMemAccesses.back();
 				tempAccess.id = curAccessID++;
 				tempAccess.ts = ts;
-				tempAccess.alloc_id = itAlloc->second.id;
+				tempAccess.alloc_id = alloc->id;
 				tempAccess.action = action;
 				tempAccess.size = size;
 				tempAccess.address = address;
 				tempAccess.ctx = ctx;
-				tempAccess.stacktrace_id = addStacktrace(kernelBaseDir, stacktracesOFile, delimiter, instrPtr, stacktrace);
+				tempAccess.stacktrace_id = addStacktrace(kernelBaseDir, stacktracesOFile, event.instrPtr, event.stacktrace);
 				break;
 				}
 		default:
@@ -859,32 +956,39 @@ int main(int argc, char *argv[]) {
 			}
 		}
 	}
+	// A corrupt or truncated trace ends like a complete one. Do not pretend that the tables are complete.
+	if (traceReader->failed() || (binaryDecoder && binaryDecoder->failed())) {
+		cerr << "The trace ended early, after " << dec << lineCounter << " events." << endl;
+		return EXIT_FAILURE;
+	}
 
 	// Due to the fact that we abort the experiment as soon as the benchmark has finished, some allocations may not have been freed.
 	// Hence, print every allocation, which is still stored in the map, and set the freed timestamp to NULL.
-	for (itAlloc = activeAllocs.begin(); itAlloc != activeAllocs.end(); itAlloc++) {
-		Allocation& tempAlloc = itAlloc->second;
-		allocOFile << tempAlloc.id << delimiter << subclasses[tempAlloc.subclass_idx].id << delimiter << itAlloc->first << delimiter;
-		allocOFile << dec << tempAlloc.size << delimiter << dec << tempAlloc.start << delimiter << "\\N" << "\n";
-	}
+	activeAllocs.forEach([&allocOFile](uint64_t baseAddress, Allocation& tempAlloc) {
+		allocOFile.field(tempAlloc.id).field(subclasses[tempAlloc.subclass_idx].id).field(baseAddress);
+		allocOFile.field(tempAlloc.size).field(tempAlloc.start).null().endRow();
+	});
 
 	// Flush memory writes by pretending there's a final V()
-	writeMemAccesses('v', 0, &accessOFile, &lastMemAccesses);
+	writeMemAccesses('v', 0, &accessOFiles, &lastMemAccesses);
 	lockManager->closeAllTXNs(ts);
+	delete lockManager;
 
-	if (isGZ) {
-		delete gzinfile;
-	} else {
-		delete rawinfile;
-	}
+	// The parser has to stop reading before the reader is gone.
+	delete csvParser;
+	delete traceReader;
+	delete binaryDecoder;
 
+	if (resolveThreads > 0) {
+		writeDeferredStacktraces(kernelBaseDir, stacktracesOFile);
+	}
 	binaryread_destroy();
 
 	// Dump all observed subclasses
 	int i = 1;
 	for (const auto &subclass : subclasses) {
-		subclassesOFile << i << delimiter << types[subclass.data_type_idx].id << delimiter;
-		subclassesOFile << sql_null_if(subclass.name, !subclass.real_subclass) << endl;
+		subclassesOFile.field(i).field(types[subclass.data_type_idx].id);
+		subclassesOFile.nullIf(subclass.name, !subclass.real_subclass).endRow();
 		i++;
 	}
 
@@ -972,11 +1076,11 @@ int main(int argc, char *argv[]) {
 		}
 
 		for (auto id : blacklistIDs) {
-			fnblacklistOFile << fnBlID << delimiter
-				<< id << delimiter
-				<< memberID << delimiter
-				<< lineElems.at(2) << delimiter
-				<< lineElems.at(3) << endl;
+			fnblacklistOFile.field(fnBlID)
+				.field(id)
+				.field(memberID)
+				.field(lineElems.at(2))
+				.field(lineElems.at(3)).endRow();
 			fnBlID++;
 		}
 	}
@@ -1047,10 +1151,46 @@ int main(int argc, char *argv[]) {
 		}
 
 		for (auto id : blacklistIDs) {
-			memberblacklistOFile << id << delimiter << itMember->second << endl;
+			memberblacklistOFile.field(id).field(itMember->second).endRow();
 		}
 	}
 
+	bool writeFailed = false;
+	if (asyncWriters || compressor) {
+		cerr << "Writer stalls:";
+	}
+	for (const auto &outputFile : outputFiles) {
+		if (!outputFile.enabled) {
+			continue;
+		}
+		// Also waits for the writer thread or the compression to catch up
+		outputFile.oFile->close();
+		if (asyncWriters || compressor) {
+			cerr << " " << outputFile.table << "=" << dec << chrono::duration_cast<chrono::microseconds>(outputFile.oFile->stallTime()).count() << "us";
+		}
+		writeFailed |= outputFile.oFile->failed();
+	}
+	if (asyncWriters || compressor) {
+		cerr << endl;
+	}
+	// Every block has been written.
+	delete compressor;
+	if (accessColumnFile) {
+		// Writes the last row group
+		delete accessColumnFile;
+		accessColumnOFile.close();
+		if (!accessColumnOFile.good()) {
+			cerr << "Cannot write accesses.ldc" << endl;
+			writeFailed = true;
+		} else {
+			cerr << "Wrote accesses.ldc" << endl;
+		}
+	}
+	if (writeFailed) {
+		cerr << "Some output files are incomplete." << endl;
+		return EXIT_FAILURE;
+	}
+
 	cerr << "Finished." << endl;
 
 	return EXIT_SUCCESS;
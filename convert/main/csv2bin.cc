@@ -0,0 +1,115 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "config.h"
+#include "git_version.h"
+#include "tracereader.h"
+#include "binarytrace.h"
+#include "gzstream/gzstream.h"
+
+/**
+ * Transcodes a CSV trace into the binary trace format (see binarytrace.h),
+ * which can be read by convert without any text parsing.
+ * If the name of the output file ends with .gz, the binary trace is gzip'ed.
+ */
+
+using namespace std;
+
+char delimiter = DELIMITER_CHAR;
+
+static void printUsageAndExit(const char *elf) {
+	cerr << "usage: " << elf
+		<< " [options] input.csv[.gz|.zst|.lz4]|- output.bin[.gz]\n\n"
+		"Options:\n"
+		" -d  delimiter used in input.csv\n"
+		" -v  show version\n"
+		" -h  Print this help\n";
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	string_view traceLine;
+	TraceEvent event;
+	unsigned long long lineCounter, eventCounter = 0;
+	int param;
+
+	while ((param = getopt(argc,argv,"d:vh")) != -1) {
+		switch (param) {
+		case 'd':
+			delimiter = *optarg;
+			break;
+		case 'v':
+			cerr << "csv2bin version: " << GIT_BRANCH << ", " << GIT_MESSAGE << endl;
+			return EXIT_SUCCESS;
+		case 'h':
+		default:
+			printUsageAndExit(argv[0]);
+		}
+	}
+	if (argc - optind != 2) {
+		printUsageAndExit(argv[0]);
+	}
+	const char *inName = argv[optind], *outName = argv[optind + 1];
+
+	TraceReader *traceReader = openTraceReader(inName);
+	if (traceReader == NULL) {
+		cerr << "Cannot read inputfile: " << inName << endl;
+		return EXIT_FAILURE;
+	}
+	if (isBinaryTrace(traceReader)) {
+		cerr << inName << " already is a binary trace" << endl;
+		return EXIT_FAILURE;
+	}
+
+	ostream *out;
+	size_t outNameLen = strlen(outName);
+	if (outNameLen > 3 && strcmp(outName + outNameLen - 3, ".gz") == 0) {
+		out = new ogzstream(outName);
+	} else {
+		out = new ofstream(outName, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+	}
+	if (!out->good()) {
+		cerr << "Cannot open file: " << outName << endl;
+		return EXIT_FAILURE;
+	}
+
+	BinaryTraceEncoder encoder(*out);
+	encoder.writeHeader();
+	for (lineCounter = 0; traceReader->nextLine(traceLine); lineCounter++) {
+		// Skip the header if there is one.
+		if (lineCounter == 0 && (traceLine.length() == 0 || !isdigit(traceLine[0]))) {
+			continue;
+		}
+		// Always parse the context. convert decides whether to use it.
+		if (!parseCSVEvent(traceLine, delimiter, true, event, cerr)) {
+			return EXIT_FAILURE;
+		}
+		encoder.writeEvent(event);
+		eventCounter++;
+	}
+	// A corrupt or truncated trace ends like a complete one
+	if (traceReader->failed()) {
+		cerr << "The trace ended early, after " << eventCounter << " events." << endl;
+		return EXIT_FAILURE;
+	}
+	delete traceReader;
+
+	// Closing the output file writes the rest of it, e.g., the end of the gzip stream.
+	out->flush();
+	if (ogzstream *gzOut = dynamic_cast<ogzstream*>(out)) {
+		gzOut->close();
+	} else {
+		((ofstream*)out)->close();
+	}
+	if (!out->good()) {
+		cerr << "Cannot write " << outName << endl;
+		return EXIT_FAILURE;
+	}
+	delete out;
+	cerr << "Wrote " << eventCounter << " events to " << outName << endl;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,347 @@
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include "csvwriter.h"
+
+using namespace std;
+
+CSVWriter::CSVWriter() : m_fd(-1), m_direct(false), m_failed(false), m_buf(NULL), m_pos(0), m_delimiter(','), m_binary(false), m_column(0), m_async(false),
+	m_ring(), m_head(0), m_tail(0), m_stop(false), m_producerWaiting(false), m_consumerWaiting(false), m_stalled(0),
+	m_compressor(NULL), m_blocksSubmitted(0), m_blocksWritten(0) {
+}
+
+CSVWriter::~CSVWriter() {
+	close();
+	for (char *buf : m_ring) {
+		free(buf);
+	}
+}
+
+bool CSVWriter::open(const char *fname, const CSVWriterOptions &options) {
+	close();
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	m_fd = -1;
+	// Compressed blocks do not fill whole file system blocks.
+	if (options.direct && !options.compressor) {
+		m_fd = ::open(fname, flags | O_DIRECT, 0666);
+		if (m_fd < 0 && errno == EINVAL) {
+			cerr << "File system does not support O_DIRECT, writing " << fname << " buffered" << endl;
+		}
+	}
+	m_direct = m_fd >= 0;
+	struct stat st;
+	if (m_direct && (fstat(m_fd, &st) || !S_ISREG(st.st_mode))) {
+		// On a FIFO, O_DIRECT would switch to packet mode, and a reader with a smaller buffer would lose data.
+		fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+		m_direct = false;
+	}
+	if (m_fd < 0) {
+		m_fd = ::open(fname, flags, 0666);
+	}
+	if (m_fd < 0) {
+		return false;
+	}
+	start(fname, options);
+	return true;
+}
+
+void CSVWriter::open(int fd, const char *name, const CSVWriterOptions &options) {
+	close();
+	m_fd = fd;
+	m_direct = false;
+	start(name, options);
+}
+
+void CSVWriter::start(const char *name, const CSVWriterOptions &options) {
+	if (!m_ring[0]) {
+		m_ring[0] = static_cast<char*>(aligned_alloc(CSV_WRITER_ALIGNMENT, CSV_WRITER_BUFFER_SIZE));
+	}
+	m_buf = m_ring[0];
+	m_fname = name;
+	m_failed = false;
+	m_pos = 0;
+	m_delimiter = options.delimiter;
+	m_binary = options.binary;
+	m_types.clear();
+	m_column = 0;
+	m_async = options.async && !options.compressor;
+	m_head = m_tail = 0;
+	m_stop = false;
+	m_stalled = chrono::nanoseconds(0);
+	m_compressor = options.compressor;
+	m_blocksSubmitted = m_blocksWritten = 0;
+	if (m_async) {
+		m_writer = thread(&CSVWriter::writer, this);
+	}
+}
+
+void CSVWriter::close() {
+	if (m_fd < 0) {
+		return;
+	}
+	if (m_binary) {
+		// The file trailer
+		reserve(sizeof(uint16_t));
+		putBigEndian((uint16_t)-1);
+	}
+	flush();
+	if (m_compressor) {
+		waitForBlocks(0);
+		m_compressor = NULL;
+	}
+	if (m_async) {
+		auto start = chrono::steady_clock::now();
+		m_stop = true;
+		{
+			lock_guard<mutex> guard(m_lock);
+		}
+		m_wakeup.notify_all();
+		m_writer.join();
+		m_stalled += chrono::steady_clock::now() - start;
+		m_async = false;
+	}
+	if (m_pos > 0) {
+		// The tail left over by O_DIRECT does not fill a whole block, and has to go through the page cache.
+		fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+		writeAll(m_buf, m_pos);
+		m_pos = 0;
+	}
+	::close(m_fd);
+	m_fd = -1;
+}
+
+void CSVWriter::flush() {
+	if (m_compressor) {
+		compressBlock(m_pos);
+		return;
+	}
+	size_t len = m_pos;
+	if (m_direct) {
+		len &= ~(size_t)(CSV_WRITER_ALIGNMENT - 1);
+	}
+	if (m_async) {
+		handOver(len);
+		return;
+	}
+	writeAll(m_buf, len);
+	m_pos -= len;
+	memmove(m_buf, m_buf + len, m_pos);
+}
+
+void CSVWriter::handOver(size_t len) {
+	if (len == 0) {
+		return;
+	}
+	size_t tail = m_tail.load();
+	char *filled = m_buf;
+	m_lengths[tail % CSV_WRITER_RING_BUFFERS] = len;
+	m_tail.store(++tail);
+	wakeUp(m_consumerWaiting);
+
+	// Continue with the next buffer, as soon as the writer thread has written it.
+	if (tail - m_head.load() == CSV_WRITER_RING_BUFFERS) {
+		auto start = chrono::steady_clock::now();
+		sleepUntil(m_producerWaiting, [this, tail] { return tail - m_head.load() < CSV_WRITER_RING_BUFFERS; });
+		m_stalled += chrono::steady_clock::now() - start;
+	}
+	char *&next = m_ring[tail % CSV_WRITER_RING_BUFFERS];
+	if (!next) {
+		next = static_cast<char*>(aligned_alloc(CSV_WRITER_ALIGNMENT, CSV_WRITER_BUFFER_SIZE));
+	}
+	m_buf = next;
+	// The tail kept back for O_DIRECT. The writer thread only reads the filled buffer.
+	m_pos -= len;
+	memcpy(m_buf, filled + len, m_pos);
+}
+
+void CSVWriter::compressBlock(size_t len) {
+	if (len == 0) {
+		return;
+	}
+	waitForBlocks(CSV_WRITER_BLOCKS_PER_THREAD * m_compressor->threads() - 1);
+	size_t block = m_blocksSubmitted++;
+	m_compressor->compress(this, block, vector<char>(m_buf, m_buf + len));
+	m_pos = 0;
+}
+
+void CSVWriter::blockCompressed(size_t block, vector<char> &&data) {
+	{
+		lock_guard<mutex> guard(m_lock);
+		// A block is never empty. An empty one has failed to compress, and would leave a gap in the file.
+		if (data.empty() && !m_failed) {
+			cerr << "Cannot write " << m_fname << ": a block has failed to compress" << endl;
+			m_failed = true;
+		}
+		m_compressedBlocks.emplace(block, std::move(data));
+		// Whoever completes the next block in order writes it, and the blocks already waiting behind it.
+		for (auto it = m_compressedBlocks.begin(); it != m_compressedBlocks.end() && it->first == m_blocksWritten;
+			it = m_compressedBlocks.erase(it)) {
+			writeAll(it->second.data(), it->second.size());
+			m_blocksWritten++;
+		}
+	}
+	m_wakeup.notify_all();
+}
+
+void CSVWriter::waitForBlocks(size_t inFlight) {
+	unique_lock<mutex> guard(m_lock);
+	if (m_blocksSubmitted - m_blocksWritten <= inFlight) {
+		return;
+	}
+	auto start = chrono::steady_clock::now();
+	m_wakeup.wait(guard, [this, inFlight] { return m_blocksSubmitted - m_blocksWritten <= inFlight; });
+	m_stalled += chrono::steady_clock::now() - start;
+}
+
+void CSVWriter::writer() {
+	size_t head = m_head.load();
+	while (1) {
+		if (head == m_tail.load()) {
+			sleepUntil(m_consumerWaiting, [this, head] { return head != m_tail.load() || m_stop.load(); });
+			if (head == m_tail.load()) {
+				// Stopped, and every buffer has been written
+				return;
+			}
+		}
+		size_t slot = head % CSV_WRITER_RING_BUFFERS;
+		writeAll(m_ring[slot], m_lengths[slot]);
+		m_head.store(++head);
+		wakeUp(m_producerWaiting);
+	}
+}
+
+template <typename Pred>
+void CSVWriter::sleepUntil(atomic<bool> &waiting, Pred ready) {
+	unique_lock<mutex> guard(m_lock);
+	waiting = true;
+	// Announcing the wait before checking the condition once more ensures that the other side either
+	// observes the announcement and wakes us up, or has already made the condition true.
+	m_wakeup.wait(guard, ready);
+	waiting = false;
+}
+
+void CSVWriter::wakeUp(atomic<bool> &waiting) {
+	if (!waiting.load()) {
+		return;
+	}
+	{
+		// Waits until the other side actually sleeps
+		lock_guard<mutex> guard(m_lock);
+	}
+	m_wakeup.notify_all();
+}
+
+void CSVWriter::header(const vector<const char*> &names, const vector<enum COLUMN_TYPE> &types) {
+	m_types = types;
+	if (m_binary) {
+		// Signature, flags, and the length of the header extension
+		put("PGCOPY\n\377\r\n\0", 11);
+		reserve(2 * sizeof(uint32_t));
+		putBigEndian((uint32_t)0);
+		putBigEndian((uint32_t)0);
+		return;
+	}
+	for (const char *name : names) {
+		field(name);
+	}
+	endRow();
+}
+
+CSVWriter& CSVWriter::field(string_view str) {
+	reserve(CSV_WRITER_MAX_FIELD);
+	startField();
+	if (!m_binary) {
+		put(str.data(), str.size());
+		return *this;
+	}
+	enum COLUMN_TYPE type = columnType();
+	if (type == COLUMN_TEXT) {
+		putText(str);
+		return *this;
+	}
+	if (str == "\\N") {
+		putBigEndian((uint32_t)-1);
+		return *this;
+	}
+	long long value;
+	auto res = from_chars(str.data(), str.data() + str.size(), value);
+	if (res.ec != errc() || res.ptr != str.data() + str.size()) {
+		// Leave it to the database to reject it.
+		putText(str);
+	} else if (type == COLUMN_INT2) {
+		putInteger((uint16_t)value);
+	} else if (type == COLUMN_INT4) {
+		putInteger((uint32_t)value);
+	} else {
+		putInteger((uint64_t)value);
+	}
+	return *this;
+}
+
+void CSVWriter::putText(string_view str) {
+	putBigEndian((uint32_t)str.size());
+	put(str.data(), str.size());
+}
+
+void CSVWriter::put(const char *data, size_t len) {
+	if (len > CSV_WRITER_BUFFER_SIZE - m_pos) {
+		appendLarge(data, len);
+		return;
+	}
+	memcpy(m_buf + m_pos, data, len);
+	m_pos += len;
+}
+
+void CSVWriter::appendLarge(const char *data, size_t len) {
+	if (!m_direct && !m_async && !m_compressor && len >= CSV_WRITER_BUFFER_SIZE / 2) {
+		// Write the buffer and the string at once, instead of copying the string chunk by chunk.
+		struct iovec iov[2] = { { m_buf, m_pos }, { const_cast<char*>(data), len } };
+		ssize_t ret;
+		do {
+			ret = writev(m_fd, iov, 2);
+		} while (ret < 0 && errno == EINTR);
+		size_t written = max(ret, (ssize_t)0);
+		// Complete a short write
+		if (written < m_pos) {
+			writeAll(m_buf + written, m_pos - written);
+			written = m_pos;
+		}
+		writeAll(data + (written - m_pos), len - (written - m_pos));
+		m_pos = 0;
+		return;
+	}
+	while (len > 0) {
+		size_t chunk = min(len, CSV_WRITER_BUFFER_SIZE - m_pos);
+		memcpy(m_buf + m_pos, data, chunk);
+		m_pos += chunk;
+		data += chunk;
+		len -= chunk;
+		if (m_pos == CSV_WRITER_BUFFER_SIZE) {
+			flush();
+		}
+	}
+}
+
+void CSVWriter::writeAll(const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t ret = write(m_fd, data, len);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// Report the first error only. The remaining rows are dropped, like an ofstream would do.
+			if (!m_failed) {
+				cerr << "Cannot write " << m_fname << ": " << strerror(errno) << endl;
+				m_failed = true;
+			}
+			return;
+		}
+		data += ret;
+		len -= ret;
+	}
+}
@@ -0,0 +1,283 @@
+#ifndef __CSVWRITER_H__
+#define __CSVWRITER_H__
+
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "compressionpool.h"
+
+#define CSV_WRITER_BUFFER_SIZE		(1 << 20)		// Bytes gathered before they are written to the file
+#define CSV_WRITER_ALIGNMENT		4096			// Alignment of the buffer, and of each write with O_DIRECT
+#define CSV_WRITER_MAX_FIELD		32				// Upper bound of the length of a formatted integer including its framing
+#define CSV_WRITER_RING_BUFFERS		4				// Buffers in flight between the producer and the writer thread
+#define CSV_WRITER_BLOCKS_PER_THREAD	2				// Blocks in flight per compression worker
+
+/**
+ * The PostgreSQL type of a column. It is only needed for the binary COPY format.
+ * Enums, e.g., access_type, are sent as text.
+ */
+enum COLUMN_TYPE {
+	COLUMN_INT2 = 0,
+	COLUMN_INT4,
+	COLUMN_INT8,
+	COLUMN_TEXT
+};
+
+struct CSVWriterOptions {
+	char delimiter;												// Separates the fields of a CSV row
+	bool binary;												// Write PostgreSQL's binary COPY format instead of CSV
+	bool direct;												// Write the file with O_DIRECT, bypassing the page cache
+	bool async;													// Write the file on a thread of its own
+	CompressionPool *compressor;								// Compress the file in blocks on this pool, or NULL
+};
+
+/**
+ * Writes one of the tables which are imported into the database, either as CSV or in PostgreSQL's binary COPY format.
+ * A table starts with header(). Afterwards, each row is written field by field, and ends with endRow().
+ * Rows are formatted straight into a large, page-aligned buffer, which is written with a single system call once it is full.
+ * In CSV, numbers are always formatted as decimals, and no conversion passes through a temporary string.
+ * Unlike an ofstream, the writer has no formatting state, e.g., dec or hex, and no locale.
+ * In the binary format, each field is written in the representation of the type its column has in the database,
+ * so that the database does not have to parse it. Integers are written in network byte order, but not range-checked.
+ * With {@param direct}, only whole blocks are written with O_DIRECT. The last block is written through the page cache on close().
+ * With {@param async}, the writer owns a thread, which does the actual writes.
+ * Full buffers are handed to it through a lock-free single-producer/single-consumer ring of CSV_WRITER_RING_BUFFERS buffers.
+ * If the thread falls behind, the producer blocks until a buffer becomes free. The time spent blocked is reported by stallTime().
+ * With a {@param compressor}, each full buffer is compressed as an independent block on the pool instead,
+ * and whichever worker completes the next block in order writes it. Neither O_DIRECT nor a writer thread is used then.
+ * The producer only blocks if CSV_WRITER_BLOCKS_PER_THREAD blocks per worker are in flight.
+ * The writer has to be opened before anything is written to it. The buffer is flushed when the writer is closed or destructed.
+ */
+struct CSVWriter : public CompressedBlockSink {
+	CSVWriter();
+	CSVWriter(const CSVWriter&) = delete;
+	~CSVWriter();
+
+	/**
+	 * Creates or truncates {@param fname}. Returns false if the file cannot be opened.
+	 * Falls back to buffered I/O if O_DIRECT is requested, but the file system does not support it.
+	 */
+	bool open(const char *fname, const CSVWriterOptions &options);
+	/**
+	 * Writes to the file descriptor {@param fd}, e.g., stdout, which is closed along with the writer.
+	 * {@param name} is only used in error messages.
+	 */
+	void open(int fd, const char *name, const CSVWriterOptions &options);
+	bool isOpen() const {
+		return m_fd >= 0;
+	}
+	/**
+	 * Writes the remaining rows, and waits for the writer thread or the compression of the last block to finish.
+	 */
+	void close();
+	/**
+	 * Returns how long the producer has been blocked, because the writer thread or the compression fell behind.
+	 */
+	std::chrono::nanoseconds stallTime() const {
+		return m_stalled;
+	}
+	/**
+	 * Tells whether rows have been lost, because a write or the compression of a block has failed.
+	 * The whole file is only known to be complete after close().
+	 */
+	bool failed() const {
+		return m_failed;
+	}
+
+	/**
+	 * Starts the table. A CSV file begins with the column {@param names}, a binary one with the COPY signature.
+	 * The binary format needs the {@param types} of the columns. The names do not necessarily correspond to them.
+	 */
+	void header(const std::vector<const char*> &names, const std::vector<enum COLUMN_TYPE> &types);
+
+	template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+	CSVWriter& field(T value) {
+		reserve(CSV_WRITER_MAX_FIELD);
+		startField();
+		if (!m_binary) {
+			m_pos = std::to_chars(m_buf + m_pos, m_buf + CSV_WRITER_BUFFER_SIZE, value).ptr - m_buf;
+			return *this;
+		}
+		switch (columnType()) {
+		case COLUMN_INT2:
+			putInteger((uint16_t)value);
+			break;
+		case COLUMN_INT4:
+			putInteger((uint32_t)value);
+			break;
+		case COLUMN_INT8:
+			putInteger((uint64_t)value);
+			break;
+		case COLUMN_TEXT:
+			{
+				char tmp[CSV_WRITER_MAX_FIELD];
+				auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+				putText(std::string_view(tmp, res.ptr - tmp));
+				break;
+			}
+		}
+		return *this;
+	}
+
+	/**
+	 * In the binary format, a string written to an integer column is parsed, e.g., an ID read from a blacklist.
+	 */
+	CSVWriter& field(std::string_view str);
+
+	CSVWriter& field(const char *str) {
+		return field(std::string_view(str));
+	}
+
+	CSVWriter& field(const std::string &str) {
+		return field(std::string_view(str));
+	}
+
+	CSVWriter& field(char c) {
+		return field(std::string_view(&c, 1));
+	}
+
+	CSVWriter& null() {
+		reserve(CSV_WRITER_MAX_FIELD);
+		startField();
+		if (m_binary) {
+			putBigEndian((uint32_t)-1);
+		} else {
+			memcpy(m_buf + m_pos, "\\N", 2);
+			m_pos += 2;
+		}
+		return *this;
+	}
+
+	/**
+	 * Writes {@param value}, or NULL if {@param cond} is true.
+	 */
+	template <typename T>
+	CSVWriter& nullIf(const T &value, bool cond) {
+		if (cond) {
+			return null();
+		}
+		return field(value);
+	}
+
+	void endRow() {
+		if (!m_binary) {
+			reserve(1);
+			m_buf[m_pos++] = '\n';
+		}
+		m_column = 0;
+	}
+
+	/**
+	 * Writes the buffer to the file, or hands it to the writer thread or the compression pool.
+	 * With O_DIRECT, a tail which does not fill a whole block is kept back.
+	 */
+	void flush();
+
+	void blockCompressed(size_t block, std::vector<char> &&data);
+
+	private:
+	int m_fd;
+	bool m_direct;												// The file has been opened with O_DIRECT
+	bool m_failed;												// A write has failed, and the error has been reported
+	std::string m_fname;
+	char *m_buf;												// CSV_WRITER_BUFFER_SIZE bytes, aligned to CSV_WRITER_ALIGNMENT
+	size_t m_pos;												// Number of bytes used in m_buf
+	char m_delimiter;
+	bool m_binary;
+	std::vector<enum COLUMN_TYPE> m_types;						// Column types of the binary format
+	size_t m_column;											// Index of the next field within the current row
+
+	// The ring of buffers, only used with a writer thread. The producer fills the buffer m_tail refers to.
+	// The writer thread writes the buffers from m_head up to, but excluding m_tail.
+	bool m_async;
+	char *m_ring[CSV_WRITER_RING_BUFFERS];						// Allocated on first use, m_ring[0] is m_buf without a thread
+	size_t m_lengths[CSV_WRITER_RING_BUFFERS];					// Number of bytes to be written from each buffer
+	std::atomic<size_t> m_head;									// Advanced by the writer thread
+	std::atomic<size_t> m_tail;									// Advanced by the producer
+	std::atomic<bool> m_stop;									// Tells the writer thread to quit once the ring is empty
+	std::thread m_writer;
+	// Only needed to sleep if the ring is empty or full. Each side announces that it is about to sleep,
+	// and the other side only takes the lock to wake it up if it has done so.
+	// With compression, the lock protects the compressed blocks, and the producer waits on m_wakeup for them to be written.
+	std::mutex m_lock;
+	std::condition_variable m_wakeup;
+	std::atomic<bool> m_producerWaiting;
+	std::atomic<bool> m_consumerWaiting;
+	std::chrono::nanoseconds m_stalled;
+
+	// Blocks are numbered in the order they are handed to the compression pool, and written in that order.
+	CompressionPool *m_compressor;
+	size_t m_blocksSubmitted;
+	size_t m_blocksWritten;										// Protected by m_lock
+	std::map<size_t, std::vector<char>> m_compressedBlocks;		// Compressed, but not yet written. Protected by m_lock.
+
+	void reserve(size_t len) {
+		if (CSV_WRITER_BUFFER_SIZE - m_pos < len) {
+			flush();
+		}
+	}
+
+	enum COLUMN_TYPE columnType() const {
+		// Fields exceeding the header are written as text, and are rejected by the database.
+		return m_column <= m_types.size() ? m_types[m_column - 1] : COLUMN_TEXT;
+	}
+
+	/**
+	 * Separates the field from the previous one, or starts the row. Needs CSV_WRITER_MAX_FIELD bytes of space.
+	 */
+	void startField() {
+		if (m_binary) {
+			if (m_column == 0) {
+				putBigEndian((uint16_t)m_types.size());
+			}
+		} else if (m_column > 0) {
+			m_buf[m_pos++] = m_delimiter;
+		}
+		m_column++;
+	}
+
+	/**
+	 * Appends the unsigned integer {@param value} in network byte order.
+	 */
+	template <typename T>
+	void putBigEndian(T value) {
+		for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+			m_buf[m_pos++] = (char)(value >> shift);
+		}
+	}
+
+	/**
+	 * Appends a binary field, i.e., its length and {@param value}.
+	 */
+	template <typename T>
+	void putInteger(T value) {
+		putBigEndian((uint32_t)sizeof(T));
+		putBigEndian(value);
+	}
+
+	void putText(std::string_view str);
+	void put(const char *data, size_t len);
+	void appendLarge(const char *data, size_t len);
+	void start(const char *name, const CSVWriterOptions &options);
+	void writeAll(const char *data, size_t len);
+	void handOver(size_t len);
+	void compressBlock(size_t len);
+	void waitForBlocks(size_t inFlight);
+	void writer();
+	template <typename Pred>
+	void sleepUntil(std::atomic<bool> &waiting, Pred ready);
+	void wakeUp(std::atomic<bool> &waiting);
+};
+
+#endif // __CSVWRITER_H__
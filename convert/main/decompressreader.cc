@@ -0,0 +1,637 @@
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+#include <lz4frame.h>
+
+#include "decompressreader.h"
+
+using namespace std;
+
+#define ZSTD_MAGIC				0xFD2FB528
+#define LZ4_MAGIC				0x184D2204
+#define SKIPPABLE_MAGIC			0x184D2A50		// Shared by zstd and lz4. The lowest four bits may vary.
+#define SKIPPABLE_MAGIC_MASK	0xFFFFFFF0
+
+static inline uint32_t readLE32(const void *ptr) {
+	const unsigned char *buf = (const unsigned char*)ptr;
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+enum COMPRESSION detectCompression(const unsigned char *buf, size_t len) {
+	if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b) {
+		return COMPRESSION_GZIP;
+	} else if (len >= 4 && readLE32(buf) == ZSTD_MAGIC) {
+		return COMPRESSION_ZSTD;
+	} else if (len >= 4 && readLE32(buf) == LZ4_MAGIC) {
+		return COMPRESSION_LZ4;
+	}
+	return COMPRESSION_NONE;
+}
+
+/**
+ * Returns the size of the lz4 frame at {@param buf}, or 0 if it is malformed or truncated.
+ * Unlike zstd, liblz4 does not offer this, so the frame is walked block by block.
+ */
+static size_t lz4FrameSize(const char *buf, size_t len) {
+	size_t pos, blockSize;
+	unsigned char flags;
+	bool blockChecksum;
+
+	// magic, FLG, BD, [content size], [dictionary id], HC
+	if (len < 7) {
+		return 0;
+	}
+	flags = buf[4];
+	blockChecksum = flags & 0x10;
+	pos = 7 + (flags & 0x08 ? 8 : 0) + (flags & 0x01 ? 4 : 0);
+	while (1) {
+		if (pos + 4 > len) {
+			return 0;
+		}
+		blockSize = readLE32(buf + pos) & 0x7FFFFFFF;
+		pos += 4;
+		// EndMark
+		if (blockSize == 0) {
+			break;
+		}
+		pos += blockSize + (blockChecksum ? 4 : 0);
+	}
+	// Content checksum
+	if (flags & 0x04) {
+		pos += 4;
+	}
+	return pos <= len ? pos : 0;
+}
+
+DecompressTraceReader::DecompressTraceReader(enum COMPRESSION compression, unsigned threads) :
+	m_compression(compression), m_threads(threads), m_nextFrame(0), m_consumed(0), m_stop(false) {
+	if (m_threads == 0) {
+		m_threads = thread::hardware_concurrency();
+		if (m_threads == 0) {
+			m_threads = 1;
+		}
+	}
+}
+
+DecompressTraceReader::~DecompressTraceReader() {
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_stop = true;
+	}
+	m_spaceFreed.notify_all();
+	for (auto &worker : m_workers) {
+		worker.join();
+	}
+}
+
+bool DecompressTraceReader::open(const char *fname) {
+	if (!m_input.open(fname)) {
+		cerr << "Compressed traces have to be regular files: " << fname << endl;
+		return false;
+	}
+	if (!scanFrames()) {
+		return false;
+	}
+	// There is no point in starting more workers than there are frames.
+	if (m_threads > m_frames.size()) {
+		m_threads = m_frames.size();
+	}
+	m_slots.resize(max(1U, m_threads * DECOMPRESS_FRAMES_PER_THREAD));
+	for (auto &slot : m_slots) {
+		slot.frame = SIZE_MAX;
+	}
+	for (unsigned i = 0; i < m_threads; i++) {
+		m_workers.emplace_back(&DecompressTraceReader::worker, this);
+	}
+	return true;
+}
+
+bool DecompressTraceReader::scanFrames() {
+	const char *base = m_input.data();
+	size_t size = m_input.size(), pos = 0, len;
+	uint32_t magic;
+
+	while (pos < size) {
+		if (size - pos < 8) {
+			cerr << "Compressed trace is truncated at offset " << pos << endl;
+			return false;
+		}
+		magic = readLE32(base + pos);
+		if ((magic & SKIPPABLE_MAGIC_MASK) == SKIPPABLE_MAGIC) {
+			len = 8 + (size_t)readLE32(base + pos + 4);
+			if (len > size - pos) {
+				cerr << "Compressed trace is truncated at offset " << pos << endl;
+				return false;
+			}
+		} else if (m_compression == COMPRESSION_ZSTD) {
+			len = ZSTD_findFrameCompressedSize(base + pos, size - pos);
+			if (ZSTD_isError(len)) {
+				cerr << "Invalid zstd frame at offset " << pos << ": " << ZSTD_getErrorName(len) << endl;
+				return false;
+			}
+			m_frames.push_back({base + pos, len});
+		} else {
+			if (magic != LZ4_MAGIC || (len = lz4FrameSize(base + pos, size - pos)) == 0) {
+				cerr << "Invalid lz4 frame at offset " << pos << endl;
+				return false;
+			}
+			m_frames.push_back({base + pos, len});
+		}
+		pos += len;
+	}
+	return true;
+}
+
+void DecompressTraceReader::worker() {
+	ZSTD_DCtx *zstdCtx = NULL;
+	LZ4F_dctx *lz4Ctx = NULL;
+	size_t frame;
+	bool ok;
+
+	// Each worker keeps its own context for all of its frames.
+	if (m_compression == COMPRESSION_ZSTD) {
+		zstdCtx = ZSTD_createDCtx();
+	} else if (LZ4F_isError(LZ4F_createDecompressionContext(&lz4Ctx, LZ4F_VERSION))) {
+		lz4Ctx = NULL;
+	}
+	while (1) {
+		{
+			unique_lock<mutex> guard(m_lock);
+			// Do not run more than m_slots.size() frames ahead of the reader
+			m_spaceFreed.wait(guard, [this] {
+				return m_stop || m_nextFrame >= m_frames.size() || m_nextFrame < m_consumed + m_slots.size(); });
+			if (m_stop || m_nextFrame >= m_frames.size()) {
+				break;
+			}
+			frame = m_nextFrame++;
+			FrameSlot &slot = m_slots[frame % m_slots.size()];
+			slot.frame = frame;
+			slot.done = slot.failed = false;
+			slot.chunks.clear();
+		}
+		if (zstdCtx != NULL) {
+			ok = decompressZSTD(zstdCtx, frame);
+		} else if (lz4Ctx != NULL) {
+			ok = decompressLZ4(lz4Ctx, frame);
+		} else {
+			cerr << "Cannot create decompression context" << endl;
+			ok = false;
+		}
+		{
+			lock_guard<mutex> guard(m_lock);
+			FrameSlot &slot = m_slots[frame % m_slots.size()];
+			slot.done = true;
+			slot.failed = !ok;
+		}
+		m_chunkReady.notify_all();
+	}
+	ZSTD_freeDCtx(zstdCtx);
+	LZ4F_freeDecompressionContext(lz4Ctx);
+}
+
+bool DecompressTraceReader::pushChunk(size_t frame, vector<char> &&chunk) {
+	unique_lock<mutex> guard(m_lock);
+	FrameSlot &slot = m_slots[frame % m_slots.size()];
+
+	m_spaceFreed.wait(guard, [this, &slot] {
+		return m_stop || slot.chunks.size() < DECOMPRESS_CHUNKS_PER_FRAME; });
+	if (m_stop) {
+		return false;
+	}
+	slot.chunks.push_back(move(chunk));
+	guard.unlock();
+	m_chunkReady.notify_all();
+	return true;
+}
+
+bool DecompressTraceReader::decompressZSTD(void *ctx, size_t frame) {
+	ZSTD_DCtx *dctx = (ZSTD_DCtx*)ctx;
+	ZSTD_inBuffer in = { m_frames[frame].data, m_frames[frame].len, 0 };
+	size_t ret;
+
+	ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+	do {
+		vector<char> chunk(DECOMPRESS_CHUNK_SIZE);
+		ZSTD_outBuffer out = { chunk.data(), chunk.size(), 0 };
+		do {
+			ret = ZSTD_decompressStream(dctx, &out, &in);
+			if (ZSTD_isError(ret)) {
+				cerr << "Cannot decompress zstd frame " << frame << ": " << ZSTD_getErrorName(ret) << endl;
+				return false;
+			}
+			if (ret != 0 && in.pos == in.size && out.pos < out.size) {
+				cerr << "zstd frame " << frame << " is truncated" << endl;
+				return false;
+			}
+		} while (ret != 0 && out.pos < out.size);
+		chunk.resize(out.pos);
+		if (!chunk.empty() && !pushChunk(frame, move(chunk))) {
+			return false;
+		}
+	} while (ret != 0);
+	return true;
+}
+
+bool DecompressTraceReader::decompressLZ4(void *ctx, size_t frame) {
+	LZ4F_dctx *dctx = (LZ4F_dctx*)ctx;
+	const char *src = m_frames[frame].data;
+	size_t srcLeft = m_frames[frame].len, outPos, dstSize, srcSize, ret = 1;
+
+	LZ4F_resetDecompressionContext(dctx);
+	do {
+		vector<char> chunk(DECOMPRESS_CHUNK_SIZE);
+		outPos = 0;
+		do {
+			dstSize = chunk.size() - outPos;
+			srcSize = srcLeft;
+			ret = LZ4F_decompress(dctx, chunk.data() + outPos, &dstSize, src, &srcSize, NULL);
+			if (LZ4F_isError(ret)) {
+				cerr << "Cannot decompress lz4 frame " << frame << ": " << LZ4F_getErrorName(ret) << endl;
+				return false;
+			}
+			src += srcSize;
+			srcLeft -= srcSize;
+			outPos += dstSize;
+			if (ret != 0 && srcLeft == 0 && dstSize == 0) {
+				cerr << "lz4 frame " << frame << " is truncated" << endl;
+				return false;
+			}
+		} while (ret != 0 && outPos < chunk.size());
+		chunk.resize(outPos);
+		if (!chunk.empty() && !pushChunk(frame, move(chunk))) {
+			return false;
+		}
+	} while (ret != 0);
+	return true;
+}
+
+bool DecompressTraceReader::nextChunk() {
+	unique_lock<mutex> guard(m_lock);
+
+	while (m_consumed < m_frames.size()) {
+		FrameSlot &slot = m_slots[m_consumed % m_slots.size()];
+		m_chunkReady.wait(guard, [this, &slot] {
+			return slot.frame == m_consumed && (!slot.chunks.empty() || slot.done); });
+		if (!slot.chunks.empty()) {
+			m_current.swap(slot.chunks.front());
+			slot.chunks.pop_front();
+			m_pos = 0;
+			guard.unlock();
+			m_spaceFreed.notify_all();
+			return true;
+		}
+		if (slot.failed) {
+			// The error message has already been printed by the worker
+			m_failed = true;
+			m_consumed = m_frames.size();
+			m_stop = true;
+			guard.unlock();
+			m_spaceFreed.notify_all();
+			return false;
+		}
+		// The frame is done. Its slot may be reused.
+		m_consumed++;
+		m_spaceFreed.notify_all();
+	}
+	return false;
+}
+
+bool ChunkTraceReader::nextLine(string_view &line) {
+	const char *start, *end;
+	size_t avail;
+	bool carried = false;
+
+	while (1) {
+		if (m_pos >= m_current.size()) {
+			if (!nextChunk()) {
+				// Last line without a trailing newline
+				if (carried) {
+					line = m_line;
+					return true;
+				}
+				return false;
+			}
+			continue;
+		}
+		start = m_current.data() + m_pos;
+		avail = m_current.size() - m_pos;
+		end = (const char*)memchr(start, '\n', avail);
+		if (end != NULL) {
+			m_pos += (end - start) + 1;
+			if (!carried) {
+				// The common case: the line is handed out in place.
+				line = string_view(start, end - start);
+			} else {
+				m_line.append(start, end - start);
+				line = m_line;
+			}
+			return true;
+		}
+		// The line continues in the next chunk
+		if (!carried) {
+			m_line.clear();
+			carried = true;
+		}
+		m_line.append(start, avail);
+		m_pos = m_current.size();
+	}
+}
+
+size_t ChunkTraceReader::read(void *buf, size_t len) {
+	size_t done = 0, bytes;
+
+	while (done < len) {
+		if (m_pos >= m_current.size() && !nextChunk()) {
+			break;
+		}
+		bytes = min(len - done, m_current.size() - m_pos);
+		memcpy((char*)buf + done, m_current.data() + m_pos, bytes);
+		m_pos += bytes;
+		done += bytes;
+	}
+	return done;
+}
+
+int ChunkTraceReader::peek() {
+	if (m_pos >= m_current.size() && !nextChunk()) {
+		return EOF;
+	}
+	return (unsigned char)m_current[m_pos];
+}
+
+PipeTraceReader::PipeTraceReader(int fd, enum COMPRESSION compression, const unsigned char *peeked, size_t peekedLen) :
+	m_fd(fd), m_compression(compression), m_peeked((const char*)peeked, peekedLen), m_done(false), m_producerFailed(false), m_readFailed(false), m_stop(false) {
+	m_producer = thread(&PipeTraceReader::producer, this);
+}
+
+PipeTraceReader::~PipeTraceReader() {
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_stop = true;
+	}
+	m_spaceFreed.notify_all();
+	m_producer.join();
+	close(m_fd);
+}
+
+void PipeTraceReader::producer() {
+	bool ok;
+
+	switch (m_compression) {
+	case COMPRESSION_GZIP:
+		ok = inflateGZIP();
+		break;
+	case COMPRESSION_ZSTD:
+		ok = decompressZSTD();
+		break;
+	case COMPRESSION_LZ4:
+		ok = decompressLZ4();
+		break;
+	default:
+		ok = copyRaw();
+		break;
+	}
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_done = true;
+		// Being stopped by the destructor is no error.
+		m_producerFailed = (!ok || m_readFailed) && !m_stop;
+	}
+	m_chunkReady.notify_all();
+}
+
+size_t PipeTraceReader::readInput(char *buf, size_t len) {
+	ssize_t bytes;
+
+	// The bytes consumed while detecting the compression come first.
+	if (!m_peeked.empty()) {
+		len = min(len, m_peeked.size());
+		memcpy(buf, m_peeked.data(), len);
+		m_peeked.erase(0, len);
+		return len;
+	}
+	do {
+		bytes = ::read(m_fd, buf, len);
+	} while (bytes < 0 && errno == EINTR);
+	if (bytes < 0) {
+		perror("PipeTraceReader::readInput()->read");
+		m_readFailed = true;
+		return 0;
+	}
+	return bytes;
+}
+
+bool PipeTraceReader::pushChunk(vector<char> &&chunk) {
+	unique_lock<mutex> guard(m_lock);
+
+	m_spaceFreed.wait(guard, [this] { return m_stop || m_chunks.size() < PIPE_CHUNKS; });
+	if (m_stop) {
+		return false;
+	}
+	m_chunks.push_back(move(chunk));
+	guard.unlock();
+	m_chunkReady.notify_all();
+	return true;
+}
+
+bool PipeTraceReader::copyRaw() {
+	size_t len, bytes;
+
+	do {
+		vector<char> chunk(DECOMPRESS_CHUNK_SIZE);
+		// Fill the whole chunk. A pipe delivers much less at once.
+		for (len = 0; len < chunk.size(); len += bytes) {
+			bytes = readInput(chunk.data() + len, chunk.size() - len);
+			if (bytes == 0) {
+				break;
+			}
+		}
+		chunk.resize(len);
+		if (!chunk.empty() && !pushChunk(move(chunk))) {
+			return false;
+		}
+	} while (len == DECOMPRESS_CHUNK_SIZE);
+	return true;
+}
+
+bool PipeTraceReader::inflateGZIP() {
+	vector<char> in(PIPE_INPUT_SIZE), chunk(DECOMPRESS_CHUNK_SIZE);
+	z_stream zs;
+	size_t bytes;
+	bool eof = false, inMember = false, ok = true;
+	unsigned long members = 0;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	// 15 + 16: gzip format with the largest window
+	if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+		cerr << "Cannot initialize zlib: " << (zs.msg ? zs.msg : "") << endl;
+		return false;
+	}
+	zs.next_out = (Bytef*)chunk.data();
+	zs.avail_out = chunk.size();
+	while (1) {
+		if (zs.avail_in == 0 && !eof) {
+			bytes = readInput(in.data(), in.size());
+			eof = bytes == 0;
+			zs.next_in = (Bytef*)in.data();
+			zs.avail_in = bytes;
+		}
+		if (zs.avail_in == 0 && eof && !inMember) {
+			break;
+		}
+		ret = inflate(&zs, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			// Like gzread(), continue with the next member of a concatenated file
+			inflateReset(&zs);
+			inMember = false;
+			members++;
+		} else if (ret == Z_DATA_ERROR && !inMember && members > 0) {
+			// Like gzread(), ignore trailing data after a member, which is not another member
+			break;
+		} else if (ret == Z_OK) {
+			inMember = true;
+		} else if (ret == Z_BUF_ERROR && eof && zs.avail_in == 0) {
+			cerr << "gzip'ed trace is truncated" << endl;
+			ok = false;
+			break;
+		} else if (ret != Z_BUF_ERROR) {
+			cerr << "Cannot decompress gzip'ed trace: " << (zs.msg ? zs.msg : zError(ret)) << endl;
+			ok = false;
+			break;
+		}
+		if (zs.avail_out == 0) {
+			if (!pushChunk(move(chunk))) {
+				inflateEnd(&zs);
+				return false;
+			}
+			chunk = vector<char>(DECOMPRESS_CHUNK_SIZE);
+			zs.next_out = (Bytef*)chunk.data();
+			zs.avail_out = chunk.size();
+		}
+	}
+	chunk.resize(chunk.size() - zs.avail_out);
+	inflateEnd(&zs);
+	// The data decompressed before an error is handed out nevertheless.
+	return (chunk.empty() || pushChunk(move(chunk))) && ok;
+}
+
+bool PipeTraceReader::decompressZSTD() {
+	vector<char> in(PIPE_INPUT_SIZE), chunk(DECOMPRESS_CHUNK_SIZE);
+	ZSTD_DCtx *dctx = ZSTD_createDCtx();
+	ZSTD_inBuffer input = { in.data(), 0, 0 };
+	ZSTD_outBuffer output = { chunk.data(), chunk.size(), 0 };
+	size_t ret = 0, bytes, lastPos;
+	bool eof = false, ok = true;
+
+	if (dctx == NULL) {
+		cerr << "Cannot create decompression context" << endl;
+		return false;
+	}
+	while (1) {
+		if (input.pos == input.size && !eof) {
+			bytes = readInput(in.data(), in.size());
+			eof = bytes == 0;
+			input.size = bytes;
+			input.pos = 0;
+		}
+		// ret is 0 at a frame boundary. The stream may continue with the next frame.
+		if (input.pos == input.size && eof && ret == 0) {
+			break;
+		}
+		lastPos = output.pos;
+		ret = ZSTD_decompressStream(dctx, &output, &input);
+		if (ZSTD_isError(ret)) {
+			cerr << "Cannot decompress zstd trace: " << ZSTD_getErrorName(ret) << endl;
+			ok = false;
+			break;
+		}
+		if (ret != 0 && eof && input.pos == input.size && output.pos == lastPos && output.pos < output.size) {
+			cerr << "zstd trace is truncated" << endl;
+			ok = false;
+			break;
+		}
+		if (output.pos == output.size) {
+			if (!pushChunk(move(chunk))) {
+				ZSTD_freeDCtx(dctx);
+				return false;
+			}
+			chunk = vector<char>(DECOMPRESS_CHUNK_SIZE);
+			output = { chunk.data(), chunk.size(), 0 };
+		}
+	}
+	chunk.resize(output.pos);
+	ZSTD_freeDCtx(dctx);
+	return (chunk.empty() || pushChunk(move(chunk))) && ok;
+}
+
+bool PipeTraceReader::decompressLZ4() {
+	vector<char> in(PIPE_INPUT_SIZE), chunk(DECOMPRESS_CHUNK_SIZE);
+	LZ4F_dctx *dctx;
+	size_t ret = 0, bytes, inPos = 0, inLen = 0, outPos = 0, srcSize, dstSize;
+	bool eof = false, ok = true;
+
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+		cerr << "Cannot create decompression context" << endl;
+		return false;
+	}
+	while (1) {
+		if (inPos == inLen && !eof) {
+			bytes = readInput(in.data(), in.size());
+			eof = bytes == 0;
+			inLen = bytes;
+			inPos = 0;
+		}
+		// ret is 0 at a frame boundary. The stream may continue with the next frame.
+		if (inPos == inLen && eof && ret == 0) {
+			break;
+		}
+		srcSize = inLen - inPos;
+		dstSize = chunk.size() - outPos;
+		ret = LZ4F_decompress(dctx, chunk.data() + outPos, &dstSize, in.data() + inPos, &srcSize, NULL);
+		if (LZ4F_isError(ret)) {
+			cerr << "Cannot decompress lz4 trace: " << LZ4F_getErrorName(ret) << endl;
+			ok = false;
+			break;
+		}
+		inPos += srcSize;
+		outPos += dstSize;
+		if (ret != 0 && eof && inPos == inLen && dstSize == 0) {
+			cerr << "lz4 trace is truncated" << endl;
+			ok = false;
+			break;
+		}
+		if (outPos == chunk.size()) {
+			if (!pushChunk(move(chunk))) {
+				LZ4F_freeDecompressionContext(dctx);
+				return false;
+			}
+			chunk = vector<char>(DECOMPRESS_CHUNK_SIZE);
+			outPos = 0;
+		}
+	}
+	chunk.resize(outPos);
+	LZ4F_freeDecompressionContext(dctx);
+	return (chunk.empty() || pushChunk(move(chunk))) && ok;
+}
+
+bool PipeTraceReader::nextChunk() {
+	unique_lock<mutex> guard(m_lock);
+
+	m_chunkReady.wait(guard, [this] { return !m_chunks.empty() || m_done; });
+	if (m_chunks.empty()) {
+		// The error message has already been printed by the producer
+		m_failed = m_producerFailed;
+		return false;
+	}
+	m_current.swap(m_chunks.front());
+	m_chunks.pop_front();
+	m_pos = 0;
+	guard.unlock();
+	m_spaceFreed.notify_all();
+	return true;
+}
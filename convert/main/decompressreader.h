@@ -0,0 +1,152 @@
+#ifndef __DECOMPRESSREADER_H__
+#define __DECOMPRESSREADER_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tracereader.h"
+
+enum COMPRESSION {
+	COMPRESSION_NONE = 0,
+	COMPRESSION_GZIP,
+	COMPRESSION_ZSTD,
+	COMPRESSION_LZ4
+};
+
+#define DECOMPRESS_CHUNK_SIZE		(4 << 20)		// Size of a decompressed chunk handed to the reader
+#define DECOMPRESS_CHUNKS_PER_FRAME	2				// Decompressed chunks a worker may buffer per frame
+#define DECOMPRESS_FRAMES_PER_THREAD	4				// Frames in flight per worker
+#define PIPE_INPUT_SIZE				(1 << 20)		// Bytes read from a pipe at once
+#define PIPE_CHUNKS					4				// Decompressed chunks buffered by PipeTraceReader
+
+/**
+ * Determine the compression of a trace by the magic number in its first {@param len} bytes {@param buf}.
+ */
+enum COMPRESSION detectCompression(const unsigned char *buf, size_t len);
+
+/**
+ * Hands out a trace which is delivered as a sequence of chunks, e.g., by decompressing it.
+ * Lines are handed out in place, and are only copied if they span two chunks.
+ */
+struct ChunkTraceReader : public TraceReader {
+	ChunkTraceReader() : m_pos(0), m_failed(false) { }
+	bool nextLine(std::string_view &line);
+	size_t read(void *buf, size_t len);
+	int peek();
+	bool failed() const {
+		return m_failed;
+	}
+
+	protected:
+	std::vector<char> m_current;								// Chunk the reader currently hands out
+	size_t m_pos;												// Offset of the next byte in m_current
+	bool m_failed;												// Set by nextChunk() if the trace is corrupt or truncated
+	/**
+	 * Replace m_current by the next chunk, and reset m_pos.
+	 * Returns false at the end of the trace, and sets m_failed if the trace ended early.
+	 */
+	virtual bool nextChunk() = 0;
+
+	private:
+	std::string m_line;											// Buffer for a line that spans two chunks
+};
+
+/**
+ * Reads a zstd or lz4 compressed trace, which resides in a regular file.
+ * The file is mapped into memory, and split into its frames up front.
+ * A pool of worker threads decompresses independent frames in parallel,
+ * e.g., the frames of a seekable zstd file or of a file written by zstd -T0 or pzstd.
+ * The decompressed data is handed out in the order of the frames.
+ * A trace consisting of a single frame is decompressed by one worker,
+ * which still overlaps with processing the trace.
+ * Skippable frames, e.g., the seek table of a seekable zstd file, are ignored.
+ */
+struct DecompressTraceReader : public ChunkTraceReader {
+	/**
+	 * Use {@param threads} workers, or one per CPU if it is 0.
+	 */
+	DecompressTraceReader(enum COMPRESSION compression, unsigned threads);
+	~DecompressTraceReader();
+	/**
+	 * Map {@param fname} into memory, locate its frames, and start the workers.
+	 * Returns false, and prints an error message, if the file is not a valid trace of the given compression.
+	 */
+	bool open(const char *fname);
+
+	private:
+	struct Frame {
+		const char *data;
+		size_t len;
+	};
+	struct FrameSlot {
+		size_t frame;												// Frame currently decompressed into this slot
+		bool done;													// All chunks of the frame have been queued
+		bool failed;												// Decompression failed. The trace ends here.
+		std::deque<std::vector<char>> chunks;						// Decompressed data not yet taken by the reader
+	};
+
+	enum COMPRESSION m_compression;
+	unsigned m_threads;
+	MmapTraceReader m_input;									// The compressed trace
+	std::vector<Frame> m_frames;								// All data frames of the trace
+	std::vector<FrameSlot> m_slots;								// Ring of frames in flight, indexed by frame % size
+	size_t m_nextFrame;											// Next frame a worker picks up
+	size_t m_consumed;											// Frame the reader currently takes chunks from
+	bool m_stop;												// Tells the workers to quit
+	std::vector<std::thread> m_workers;
+	std::mutex m_lock;											// Protects the frame slots and the counters
+	std::condition_variable m_chunkReady;						// Signalled by workers
+	std::condition_variable m_spaceFreed;						// Signalled by the reader
+
+	bool scanFrames();
+	bool nextChunk();
+	void worker();
+	bool pushChunk(size_t frame, std::vector<char> &&chunk);
+	bool decompressZSTD(void *ctx, size_t frame);
+	bool decompressLZ4(void *ctx, size_t frame);
+};
+
+/**
+ * Reads a trace from a pipe, a FIFO, or stdin, which can neither be mapped nor reopened.
+ * The caller has already consumed the first bytes of the stream to determine its compression,
+ * and hands them over as {@param peeked}.
+ * A producer thread reads and, if necessary, decompresses the stream (gzip, zstd, or lz4),
+ * so that producing the trace, e.g., by the tracer, overlaps with processing it.
+ */
+struct PipeTraceReader : public ChunkTraceReader {
+	/**
+	 * The reader takes the ownership of {@param fd}.
+	 */
+	PipeTraceReader(int fd, enum COMPRESSION compression, const unsigned char *peeked, size_t peekedLen);
+	~PipeTraceReader();
+
+	private:
+	int m_fd;
+	enum COMPRESSION m_compression;
+	std::string m_peeked;										// Bytes of the stream consumed by the caller
+	std::deque<std::vector<char>> m_chunks;						// Chunks not yet taken by the reader
+	bool m_done;												// The producer has reached the end of the stream
+	bool m_producerFailed;										// The stream is corrupt or truncated, or could not be read
+	bool m_readFailed;											// Only accessed by the producer
+	bool m_stop;												// Tells the producer to quit
+	std::thread m_producer;
+	std::mutex m_lock;											// Protects m_chunks and the flags
+	std::condition_variable m_chunkReady;						// Signalled by the producer
+	std::condition_variable m_spaceFreed;						// Signalled by the reader
+
+	bool nextChunk();
+	void producer();
+	size_t readInput(char *buf, size_t len);
+	bool pushChunk(std::vector<char> &&chunk);
+	bool copyRaw();
+	bool inflateGZIP();
+	bool decompressZSTD();
+	bool decompressLZ4();
+};
+
+#endif // __DECOMPRESSREADER_H__
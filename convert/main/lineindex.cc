@@ -0,0 +1,387 @@
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dwarf.h>
+#include <elfutils/libdw.h>
+#include <gelf.h>
+
+#include "lineindex.h"
+
+using namespace std;
+
+#define NO_ADDR					UINT64_MAX		// The function has a linkage name, or no address at all
+
+/**
+ * Walks the compilation units of the vmlinux, and fills a LineIndex.
+ */
+struct LineIndexBuilder {
+	struct Symbol {
+		uint64_t addr;
+		uint64_t size;
+		size_t section;											// Index of the ELF section the symbol belongs to
+		unsigned order;											// Index in the ELF symbol table
+		const char *name;
+	};
+	struct Section {
+		uint64_t lo;
+		uint64_t hi;
+		size_t index;
+	};
+
+	LineIndexBuilder(LineIndex &index) : index(index), compDir(NULL), nonMangled(false), files(NULL), nfiles(0) { }
+
+	LineIndex &index;
+	std::vector<LineIndex::FunctionRange> ranges;				// Address ranges of all functions, which may nest
+	const char *compDir;										// Of the current compilation unit
+	bool nonMangled;											// The language of the current compilation unit does not mangle names
+	Dwarf_Files *files;											// File table of the current compilation unit
+	size_t nfiles;
+	unordered_map<const char*, const char*> fileNames;			// libdw's file names of the current compilation unit, joined like libbfd does
+	std::vector<Symbol> symbols;								// Function symbols sorted by address, size, and reverse order
+	std::vector<Section> sections;								// Allocated sections in the order of the section headers
+	std::vector<uint64_t> firstAddrs;							// First address of each function without a linkage name, or NO_ADDR
+
+	void addUnit(Dwarf_Die *cu);
+	void addLines(Dwarf_Die *cu);
+	void addFunctions(Dwarf_Die *parent, int enclosing);
+	int addFunction(Dwarf_Die *die, int enclosing);
+	const char* fileName(const char *name);
+	void readSymbols(Elf *elf);
+	void renameFunctions();
+	/**
+	 * Returns the function symbol covering {@param pc} like _bfd_elf_find_function() chooses it, or NULL.
+	 */
+	const Symbol* findSymbol(uint64_t pc) const;
+	static bool isNonMangled(int lang);
+};
+
+bool LineIndexBuilder::isNonMangled(int lang) {
+	// The languages libbfd takes a DW_AT_name for a linkage name
+	switch (lang) {
+	case DW_LANG_C89:
+	case DW_LANG_C:
+	case DW_LANG_Ada83:
+	case DW_LANG_Cobol74:
+	case DW_LANG_Cobol85:
+	case DW_LANG_Fortran77:
+	case DW_LANG_Pascal83:
+	case DW_LANG_C99:
+	case DW_LANG_Ada95:
+	case DW_LANG_PLI:
+	case DW_LANG_UPC:
+	case DW_LANG_C11:
+	case DW_LANG_Mips_Assembler:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void LineIndexBuilder::addUnit(Dwarf_Die *cu) {
+	Dwarf_Attribute attr;
+
+	compDir = dwarf_formstring(dwarf_attr(cu, DW_AT_comp_dir, &attr));
+	nonMangled = isNonMangled(dwarf_srclang(cu));
+	fileNames.clear();
+	if (dwarf_getsrcfiles(cu, &files, &nfiles) != 0) {
+		files = NULL;
+		nfiles = 0;
+	}
+	addLines(cu);
+	addFunctions(cu, -1);
+}
+
+const char* LineIndexBuilder::fileName(const char *name) {
+	if (name == NULL) {
+		return NULL;
+	}
+	auto it = fileNames.find(name);
+	if (it != fileNames.end()) {
+		return it->second;
+	}
+	// libdw only prefixes the names residing in the compilation directory itself with it.
+	// libbfd prefixes every relative name, e.g., include/linux/list.h, as well.
+	const char *ret;
+	if (name[0] != '/' && compDir != NULL) {
+		ret = index.intern(string(compDir) + "/" + name);
+	} else {
+		ret = index.intern(name);
+	}
+	fileNames.emplace(name, ret);
+	return ret;
+}
+
+void LineIndexBuilder::addLines(Dwarf_Die *cu) {
+	Dwarf_Lines *lines;
+	size_t nlines;
+
+	if (dwarf_getsrclines(cu, &lines, &nlines) != 0) {
+		return;
+	}
+	// libdw sorts the rows by address. Of several rows with the same address, libbfd keeps the last one.
+	for (size_t i = 0; i < nlines; i++) {
+		Dwarf_Line *line = dwarf_onesrcline(lines, i);
+		Dwarf_Addr addr, nextAddr;
+		bool endSequence;
+		int lineNo;
+
+		if (dwarf_lineaddr(line, &addr) != 0 || dwarf_lineendsequence(line, &endSequence) != 0 || dwarf_lineno(line, &lineNo) != 0) {
+			continue;
+		}
+		if (endSequence) {
+			index.m_lines.push_back({ addr, NULL, 0 });
+			continue;
+		}
+		if (i + 1 < nlines && dwarf_lineaddr(dwarf_onesrcline(lines, i + 1), &nextAddr) == 0 && nextAddr == addr) {
+			continue;
+		}
+		index.m_lines.push_back({ addr, fileName(dwarf_linesrc(line, NULL, NULL)), lineNo });
+	}
+}
+
+void LineIndexBuilder::addFunctions(Dwarf_Die *parent, int enclosing) {
+	Dwarf_Die child;
+
+	if (dwarf_child(parent, &child) != 0) {
+		return;
+	}
+	do {
+		int tag = dwarf_tag(&child);
+		if (tag == DW_TAG_subprogram || tag == DW_TAG_inlined_subroutine) {
+			// Like libbfd, only an inlined function refers to the function it has been inlined into.
+			int function = addFunction(&child, tag == DW_TAG_inlined_subroutine ? enclosing : -1);
+			addFunctions(&child, function);
+		} else if (tag == DW_TAG_lexical_block) {
+			addFunctions(&child, enclosing);
+		}
+	} while (dwarf_siblingof(&child, &child) == 0);
+}
+
+int LineIndexBuilder::addFunction(Dwarf_Die *die, int enclosing) {
+	Dwarf_Attribute attr;
+	Dwarf_Word value;
+	Dwarf_Addr base, start, end;
+	ptrdiff_t offset = 0;
+
+	// libbfd prefers the linkage name. The names of inlined functions are found at their abstract origin.
+	bool isLinkage = true;										// Like libbfd's func->is_linkage
+	const char *name = dwarf_formstring(dwarf_attr_integrate(die, DW_AT_linkage_name, &attr));
+	if (name == NULL) {
+		name = dwarf_formstring(dwarf_attr_integrate(die, DW_AT_MIPS_linkage_name, &attr));
+	}
+	if (name == NULL) {
+		name = dwarf_diename(die);
+		isLinkage = nonMangled;
+	}
+	const char *callFile = "<unknown>";
+	int callLine = 0;
+	if (files != NULL && dwarf_formudata(dwarf_attr(die, DW_AT_call_file, &attr), &value) == 0 && value < nfiles) {
+		callFile = fileName(dwarf_filesrc(files, value, NULL, NULL));
+	}
+	if (dwarf_formudata(dwarf_attr(die, DW_AT_call_line, &attr), &value) == 0) {
+		callLine = value;
+	}
+
+	int function = index.m_functions.size();
+	index.m_functions.push_back({ name, enclosing, callFile, callLine });
+	firstAddrs.push_back(NO_ADDR);
+	while ((offset = dwarf_ranges(die, offset, &base, &start, &end)) > 0) {
+		if (start < end) {
+			// Like libbfd's arange_add(), which skips empty ranges, and extends the first range by the adjacent ones.
+			if (!isLinkage && (firstAddrs.back() == NO_ADDR || end == firstAddrs.back())) {
+				firstAddrs.back() = start;
+			}
+			ranges.push_back({ start, end, (unsigned)function });
+		}
+	}
+	return function;
+}
+
+LineIndex::~LineIndex() {
+	if (m_dwarf != NULL) {
+		dwarf_end(m_dwarf);
+		close(m_fd);
+	}
+}
+
+bool LineIndex::build(const char *vmlinuxName) {
+	m_fd = open(vmlinuxName, O_RDONLY);
+	if (m_fd < 0) {
+		cerr << "Cannot open file: " << vmlinuxName << endl;
+		return false;
+	}
+	// The function names point into the DWARF information. Hence, it stays open.
+	m_dwarf = dwarf_begin(m_fd, DWARF_C_READ);
+	if (m_dwarf == NULL) {
+		cerr << "Cannot read the DWARF information of " << vmlinuxName << ": " << dwarf_errmsg(-1) << endl;
+		close(m_fd);
+		return false;
+	}
+
+	LineIndexBuilder builder(*this);
+	builder.readSymbols(dwarf_getelf(m_dwarf));
+	Dwarf_Off offset = 0, next;
+	size_t headerSize;
+	while (dwarf_nextcu(m_dwarf, offset, &next, &headerSize, NULL, NULL, NULL) == 0) {
+		Dwarf_Die cu;
+		if (dwarf_offdie(m_dwarf, offset + headerSize, &cu) != NULL) {
+			builder.addUnit(&cu);
+		}
+		offset = next;
+	}
+
+	// The end of a sequence goes first, so that a sequence starting at the same address wins.
+	sort(m_lines.begin(), m_lines.end(), [](const LineRow &a, const LineRow &b) {
+		return a.addr < b.addr || (a.addr == b.addr && a.file == NULL && b.file != NULL);
+	});
+	flattenRanges(builder.ranges);
+	builder.renameFunctions();
+	m_built = true;
+	return true;
+}
+
+void LineIndex::flattenRanges(vector<FunctionRange> &ranges) {
+	vector<FunctionRange> open;
+	uint64_t pos = 0;
+
+	auto emit = [this, &pos](uint64_t hi, unsigned function) {
+		if (pos < hi) {
+			m_ranges.push_back({ pos, hi, function });
+			pos = hi;
+		}
+	};
+	// An enclosing range starts no later, and ends no earlier than the ranges nested in it.
+	// Of equal ranges, the nested one has been added last.
+	sort(ranges.begin(), ranges.end(), [](const FunctionRange &a, const FunctionRange &b) {
+		return a.lo < b.lo || (a.lo == b.lo && (a.hi > b.hi || (a.hi == b.hi && a.function < b.function)));
+	});
+	for (const auto &range : ranges) {
+		// Close the ranges ending before this one starts
+		while (!open.empty() && open.back().hi <= range.lo) {
+			emit(open.back().hi, open.back().function);
+			open.pop_back();
+		}
+		if (!open.empty()) {
+			emit(range.lo, open.back().function);
+		}
+		pos = max(pos, range.lo);
+		open.push_back(range);
+	}
+	while (!open.empty()) {
+		emit(open.back().hi, open.back().function);
+		open.pop_back();
+	}
+}
+
+void LineIndexBuilder::readSymbols(Elf *elf) {
+	Elf_Scn *scn = NULL;
+
+	if (elf == NULL) {
+		return;
+	}
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		GElf_Shdr shdr;
+		if (gelf_getshdr(scn, &shdr) == NULL) {
+			continue;
+		}
+		if (shdr.sh_flags & SHF_ALLOC) {
+			sections.push_back({ shdr.sh_addr, shdr.sh_addr + shdr.sh_size, elf_ndxscn(scn) });
+		}
+		Elf_Data *data;
+		if (shdr.sh_type != SHT_SYMTAB || shdr.sh_entsize == 0 || (data = elf_getdata(scn, NULL)) == NULL) {
+			continue;
+		}
+		// Symbol 0 is a placeholder.
+		for (size_t i = 1; i < shdr.sh_size / shdr.sh_entsize; i++) {
+			GElf_Sym sym;
+			if (gelf_getsym(data, i, &sym) == NULL || sym.st_shndx == SHN_UNDEF || sym.st_shndx >= SHN_LORESERVE) {
+				continue;
+			}
+			// Like _bfd_elf_maybe_function_sym()
+			int type = GELF_ST_TYPE(sym.st_info);
+			if (type == STT_SECTION || type == STT_FILE || type == STT_OBJECT || type == STT_TLS) {
+				continue;
+			}
+			if (sym.st_size == 0 && type == STT_NOTYPE && GELF_ST_VISIBILITY(sym.st_other) == STV_HIDDEN && GELF_ST_BIND(sym.st_info) == STB_LOCAL) {
+				continue;
+			}
+			const char *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+			if (name != NULL) {
+				symbols.push_back({ sym.st_value, sym.st_size ? sym.st_size : 1, sym.st_shndx, (unsigned)i, name });
+			}
+		}
+	}
+	// Of the symbols at the same address, libbfd prefers the largest one, and then the first one.
+	sort(symbols.begin(), symbols.end(), [](const Symbol &a, const Symbol &b) {
+		return a.addr < b.addr || (a.addr == b.addr && (a.size < b.size || (a.size == b.size && a.order > b.order)));
+	});
+}
+
+/**
+ * The first time libbfd finds a function without a linkage name as the innermost one, it names it after the function symbol
+ * covering the address looked up. If that symbol starts at the first address of the function, the function keeps the name.
+ * Later lookups use the name the function has kept. Hence, libbfd's answers depend on the order of the lookups.
+ * The index settles on the answers libbfd gives once every address has been looked up in ascending order.
+ */
+void LineIndexBuilder::renameFunctions() {
+	for (const auto &range : index.m_ranges) {
+		uint64_t firstAddr = firstAddrs[range.function];
+		if (firstAddr == NO_ADDR) {
+			continue;
+		}
+		const Symbol *symbol = findSymbol(range.lo);
+		if (symbol != NULL && symbol->addr == firstAddr) {
+			index.m_functions[range.function].name = symbol->name;
+		}
+		firstAddrs[range.function] = NO_ADDR;
+	}
+}
+
+const LineIndexBuilder::Symbol* LineIndexBuilder::findSymbol(uint64_t pc) const {
+	// libbfd searches the first allocated section covering pc.
+	auto itSection = find_if(sections.begin(), sections.end(), [pc](const Section &section) {
+		return section.lo <= pc && pc < section.hi;
+	});
+	if (itSection == sections.end()) {
+		return NULL;
+	}
+	auto it = upper_bound(symbols.begin(), symbols.end(), pc, [](uint64_t pc, const Symbol &symbol) { return pc < symbol.addr; });
+	while (it != symbols.begin() && (--it)->addr >= itSection->lo) {
+		if (it->section == itSection->index) {
+			return &*it;
+		}
+	}
+	return NULL;
+}
+
+const char* LineIndex::intern(const string &str) {
+	return m_strings.insert(str).first->c_str();
+}
+
+bool LineIndex::lookup(uint64_t pc, LineIndexLocation &location, vector<LineIndexLocation> &inlinedBy) const {
+	auto itLine = upper_bound(m_lines.begin(), m_lines.end(), pc, [](uint64_t pc, const LineRow &row) { return pc < row.addr; });
+	auto itRange = upper_bound(m_ranges.begin(), m_ranges.end(), pc, [](uint64_t pc, const FunctionRange &range) { return pc < range.lo; });
+	if (itLine == m_lines.begin() || itRange == m_ranges.begin()) {
+		return false;
+	}
+	const LineRow &row = *--itLine;
+	const FunctionRange &range = *--itRange;
+	if (row.file == NULL || pc >= range.hi) {
+		return false;
+	}
+	const Function *function = &m_functions[range.function];
+	if (function->name == NULL) {
+		return false;
+	}
+
+	location = { function->name, row.file, row.line };
+	inlinedBy.clear();
+	while (function->caller >= 0) {
+		const Function &caller = m_functions[function->caller];
+		inlinedBy.push_back({ caller.name, function->callFile, function->callLine });
+		function = &caller;
+	}
+	return true;
+}
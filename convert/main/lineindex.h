@@ -0,0 +1,82 @@
+#ifndef __LINEINDEX_H__
+#define __LINEINDEX_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+struct Dwarf;
+
+/**
+ * A code location as reported by the DWARF information. Unlike a CodeLocation,
+ * the file name still carries the compilation directory.
+ */
+struct LineIndexLocation {
+	const char *fn;
+	const char *file;
+	int line;
+};
+
+/**
+ * An in-memory index of the DWARF line tables and the (inlined) functions of the vmlinux.
+ * It is built once at startup, and resolves an instruction pointer by two binary searches,
+ * one over the sorted line table rows, and one over the address ranges of the innermost functions.
+ * The answers mimic bfd_find_nearest_line() and bfd_find_inliner_info():
+ * - The last row of the line table at or below the address yields the file and line.
+ * - The innermost function, i.e., the smallest range covering the address, yields the function name.
+ *   A function without a linkage name in a language which mangles names, e.g., C++, is named after the function symbol
+ *   starting at its first address, if that symbol also covers the lowest address the function is the innermost one at.
+ * - Each inlined function adds the location it has been inlined at, and the name of the function it has been inlined into.
+ * File names are joined with the compilation directory like libbfd does, and are interned.
+ */
+struct LineIndex {
+	LineIndex() : m_built(false), m_fd(-1), m_dwarf(NULL) { }
+	~LineIndex();
+	/**
+	 * Reads the DWARF information of {@param vmlinuxName}. Returns false, and prints an error message, if it cannot be read.
+	 */
+	bool build(const char *vmlinuxName);
+	bool built() const {
+		return m_built;
+	}
+	/**
+	 * Resolves {@param pc} to its innermost {@param location}, and the chain of locations it has been inlined at, {@param inlinedBy}.
+	 * Returns false if the index has no line or no named function for {@param pc}. libbfd knows other sources,
+	 * e.g., the ELF symbol table, and has to be asked then.
+	 */
+	bool lookup(uint64_t pc, LineIndexLocation &location, std::vector<LineIndexLocation> &inlinedBy) const;
+
+	private:
+	struct LineRow {
+		uint64_t addr;
+		const char *file;											// NULL marks the end of a sequence
+		int line;
+	};
+	struct Function {
+		const char *name;
+		int caller;													// Index of the function it has been inlined into, or -1
+		const char *callFile;
+		int callLine;
+	};
+	struct FunctionRange {
+		uint64_t lo;
+		uint64_t hi;
+		unsigned function;
+	};
+
+	bool m_built;
+	int m_fd;
+	struct Dwarf *m_dwarf;										// Holds the function names
+	std::vector<LineRow> m_lines;								// Sorted by address
+	std::vector<Function> m_functions;
+	std::vector<FunctionRange> m_ranges;						// Sorted, and disjoint. Each range refers to the innermost function.
+	std::unordered_set<std::string> m_strings;					// Interned file names
+
+	const char* intern(const std::string &str);
+	void flattenRanges(std::vector<FunctionRange> &ranges);
+
+	friend struct LineIndexBuilder;
+};
+
+#endif // __LINEINDEX_H__
@@ -1,29 +1,87 @@
-#include <set>
+#include <vector>
+#include <algorithm>
 #include "config.h"
 #include "lockmanager.h"
 #include "rlock.h"
 #include "wlock.h"
 
+LockManager::LockManager(CSVWriter& txnsOFile, CSVWriter *locksHeldOFile, CSVWriter *locksetsOFile) :
+	m_cachedCtx(DUMMY_EXECUTION_CONTEXT), m_cachedStack(NULL), m_nextTXNID(1), m_nextLockID(1), m_lockPool(max({sizeof(RWLock), sizeof(RLock), sizeof(WLock)})),
+	m_txnsOFile(txnsOFile), m_locksHeldOFile(locksHeldOFile), m_locksetsOFile(locksetsOFile) {
+
+}
+
+LockManager::~LockManager() {
+	for (auto& kv : m_locks) {
+		this->freeLock(kv.second);
+	}
+	for (RWLock *lock : m_retiredLocks) {
+		this->freeLock(lock);
+	}
+}
+
+void LockManager::freeLock(RWLock *lock) {
+	lock->~RWLock();
+	m_lockPool.release(lock);
+}
+
+TXNStack* LockManager::findStack(long ctx) {
+	if (ctx != m_cachedCtx) {
+		TXNStack **stack = m_ctxIndex.find(ctx);
+		m_cachedStack = stack ? *stack : NULL;
+		m_cachedCtx = ctx;
+	}
+	return m_cachedStack;
+}
+
+TXNStack& LockManager::getStack(long ctx) {
+	TXNStack *stack = this->findStack(ctx);
+	if (stack == NULL) {
+		stack = &m_activeTXNs.emplace_back();
+		stack->ctx = ctx;
+		*m_ctxIndex.insert(ctx) = stack;
+		m_cachedStack = stack;
+	}
+	return *stack;
+}
+
+bool LockManager::isPartOfTXN(RWLock *lock) {
+	return !lock->txnContexts[READER_LOCK].empty() || !lock->txnContexts[WRITER_LOCK].empty();
+}
+
+void LockManager::indexTXN(const TXN &txn, long ctx) {
+	txn.lock->txnContexts[txn.subLock][ctx]++;
+}
+
+void LockManager::unindexTXN(const TXN &txn, long ctx) {
+	auto& contexts = txn.lock->txnContexts[txn.subLock];
+	auto it = contexts.find(ctx);
+	if (--it->second == 0) {
+		contexts.erase(it);
+	}
+}
+
 long LockManager::findTXN(RWLock *lock, enum SUB_LOCK subLock, long ctx) {
-	for (auto& kv : m_activeTXNs) {
-		if (!this->hasActiveTXN(kv.first)) {
-			continue;
-		}
-		for (auto& elem : kv.second) {
-			if (elem.lock == lock && elem.subLock == subLock) {
-				return kv.first;
-			}
-		}
+	// If several contexts hold the lock, take the lowest one.
+	const auto& contexts = lock->txnContexts[subLock];
+	if (contexts.empty()) {
+		return ctx;
 	}
-	return ctx;
+	return contexts.begin()->first;
 }
 
 bool LockManager::hasActiveTXN(long ctx) {
-	return !m_activeTXNs[ctx].empty();
+	TXNStack *stack = this->findStack(ctx);
+	return stack && !stack->txns.empty();
 }
 
 struct TXN& LockManager::getActiveTXN(long ctx) {
-	return m_activeTXNs[ctx].back();
+	return this->findStack(ctx)->txns.back();
+}
+
+struct TXN* LockManager::activeTXN(long ctx) {
+	TXNStack *stack = this->findStack(ctx);
+	return stack && !stack->txns.empty() ? &stack->txns.back() : NULL;
 }
 
 RWLock* LockManager::findLock(unsigned long long address) {
@@ -35,45 +93,46 @@ RWLock* LockManager::findLock(unsigned long long address) {
 }
 
 void LockManager::deleteLockByArea(unsigned long long address, unsigned long long size) {
-	map<unsigned long long,RWLock*>::iterator itLock, itTemp;
-	// Iterate through the set of locks, and delete any lock that resided in the freed memory area
-	for (itLock = m_locks.begin(); itLock != m_locks.end();) {
-		if (itLock->second->lockAddress >= address && itLock->second->lockAddress < (address + size)) {
-			// Lock should not be held anymore
-			if (itLock->second->isHeld()) {
-				PRINT_ERROR("baseAddress=" << hex << showbase << address << noshowbase, "Lock at " << itLock->second->lockAddress << "is being freed but held!");
-			}
-			// Since the iterator will be invalid as soon as we delete the element, we have to advance the iterator to the next element, and remember the current one.
-			itTemp = itLock;
-			itLock++;
-			m_locks.erase(itTemp);
+	// The locks are ordered by their address. Hence, the locks that resided in the freed memory area are adjacent.
+	auto itLock = m_locks.lower_bound(address);
+	auto itEnd = itLock;
+	for (; itEnd != m_locks.end() && itEnd->first < address + size; itEnd++) {
+		RWLock *lock = itEnd->second;
+		// Lock should not be held anymore
+		if (lock->isHeld()) {
+			PRINT_ERROR("baseAddress=" << hex << showbase << address << noshowbase, "Lock at " << lock->lockAddress << "is being freed but held!");
+		}
+		// A TXN may still refer to the lock, e.g., if the trace lacks a V().
+		if (this->isPartOfTXN(lock)) {
+			m_retiredLocks.push_back(lock);
 		} else {
-			itLock++;
+			this->freeLock(lock);
 		}
 	}
+	m_locks.erase(itLock, itEnd);
 }
 
 void LockManager::closeAllTXNs(unsigned long long ts) {
-	// Close every open TXN for every context
-	for (auto& kv : m_activeTXNs) { 
+	// Close every open TXN for every context, in the order of the contexts
+	std::vector<TXNStack*> stacks;
+	for (auto& stack : m_activeTXNs) {
+		stacks.push_back(&stack);
+	}
+	sort(stacks.begin(), stacks.end(), [](const TXNStack *a, const TXNStack *b) { return a->ctx < b->ctx; });
+	for (TXNStack *stack : stacks) {
 		// Flush TXNs if there are still open ones
-		while (this->hasActiveTXN(kv.first)) {
-			auto txn = this->getActiveTXN(kv.first);
-			cerr << "TXN[" << kv.first << "]: There are still " << m_activeTXNs[kv.first].size() << " TXNs active, flushing the topmost one." << endl;
+		while (!stack->txns.empty()) {
+			auto txn = stack->txns.back();
+			cerr << "TXN[" << stack->ctx << "]: There are still " << stack->txns.size() << " TXNs active, flushing the topmost one." << endl;
 			// pretend there's a V() matching the top-most TXN's starting (P())
 			// lock at the last seen timestamp
-			this->finishTXN(txn.lock, ts, txn.subLock, false, kv.first, kv.first);
+			this->finishTXN(txn.lock, ts, txn.subLock, false, stack->ctx, stack->ctx);
 		}
 	}
 }
 
 bool LockManager::isOnTXNStack(long ctx, RWLock *lock, enum SUB_LOCK subLock) {
-	for (auto& elem : m_activeTXNs[ctx]) {
-		if (elem.lock == lock && elem.subLock == subLock) {
-			return true;
-		}
-	}
-	return false;
+	return lock->txnContexts[subLock].count(ctx) > 0;
 }
 
 /**
@@ -81,8 +140,9 @@ bool LockManager::isOnTXNStack(long ctx, RWLock *lock, enum SUB_LOCK subLock) {
  *
  * @param ts             Current timestamp
  * @param lockPtr        Lock to be released
- * @param m_txnsOFile      ofstream for txns.csv
- * @param m_locksHeldOFile ofstream for locks_held.csv
+ * @param m_txnsOFile      writer for txns.csv
+ * @param m_locksHeldOFile writer for locks_held.csv
+ * @param m_locksetsOFile  writer for locksets.csv
  */
 bool LockManager::finishTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK subLock, bool removeReader, long ctx, long ctxOld) {
 	// We have to differentiate two cases:
@@ -102,22 +162,17 @@ bool LockManager::finishTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK s
 
 	std::deque<TXN> restartTXNs;
 	bool found = false;
+	std::vector<TXN> &stack = this->getStack(ctx).txns;
 
-	while (this->hasActiveTXN(ctx)) {
-		if (!SKIP_EMPTY_TXNS || this->getActiveTXN(ctx).memAccessCounter > 0) {
-			// Record this TXN
-			m_txnsOFile << this->getActiveTXN(ctx).id << delimiter;
-			m_txnsOFile << this->getActiveTXN(ctx).start_ts << delimiter;
-			m_txnsOFile << this->getActiveTXN(ctx).start_ctx << delimiter;
-			m_txnsOFile << ts << delimiter;
-			m_txnsOFile << ctxOld << "\n";
-
+	while (!stack.empty()) {
+		TXN &activeTXN = stack.back();
+		if (!SKIP_EMPTY_TXNS || activeTXN.memAccessCounter > 0) {
 			// Note which locks were held during this TXN by looking at all
 			// TXNs "below" it (the order does not matter because we record the
 			// start timestamp).  Don't mention a lock more than once (see
 			// below).
-			std::set<decltype(RWLock::read_id)> locks_seen;
-			for (auto thisTXN : m_activeTXNs[ctx]) {
+			LocksetID lockset = LOCKSET_EMPTY;
+			for (const auto& thisTXN : stack) {
 				RWLock *tempLock = thisTXN.lock;
 				if (tempLock->isHeld()) {
 					if (tempLock->lastNPos.empty()) {
@@ -127,35 +182,51 @@ bool LockManager::finishTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK s
 					LockPos& tempLockPos = tempLock->lastNPos.top();
 					decltype(RWLock::read_id) lockID = tempLock->getID(thisTXN.subLock);
 					// Have we already seen this lock?
-					if (locks_seen.find(lockID) != locks_seen.end()) {
+					LocksetID extended = m_locksets.add(lockset, lockID);
+					if (extended == lockset) {
 						// All reader locks, for example, RCU, and the read-side of
 						// of reader-writer locks may be held multiple times, but the
 						// locks_held table structure currently does not allow
 						// this (because the lock_id is part of the PK).
 						continue;
 					}
-					locks_seen.insert(lockID);
-					m_locksHeldOFile << dec << this->getActiveTXN(ctx).id << delimiter << lockID << delimiter;
-					m_locksHeldOFile << tempLockPos.start << delimiter;
-					m_locksHeldOFile << tempLockPos.lastFile << delimiter;
-					m_locksHeldOFile << tempLockPos.lastLine << "\n";
+					lockset = extended;
+					if (m_locksHeldOFile) {
+						m_locksHeldOFile->field(activeTXN.id).field(lockID);
+						m_locksHeldOFile->field(tempLockPos.start);
+						m_locksHeldOFile->field(symbols.get(tempLockPos.lastFile));
+						m_locksHeldOFile->field(tempLockPos.lastLine).endRow();
+					}
 				} else {
 					PRINT_ERROR(tempLock->toString(thisTXN.subLock) << ",ts=" << dec << ts, "TXN: Internal error, lock is part of the TXN hierarchy but not held?");
 				}
 			}
+
+			// Record this TXN
+			m_txnsOFile.field(activeTXN.id);
+			m_txnsOFile.field(activeTXN.start_ts);
+			m_txnsOFile.field(activeTXN.start_ctx);
+			m_txnsOFile.field(ts);
+			m_txnsOFile.field(ctxOld);
+			if (m_locksetsOFile) {
+				m_txnsOFile.nullIf(lockset, lockset == LOCKSET_EMPTY);
+				this->writeLockset(lockset);
+			}
+			m_txnsOFile.endRow();
 		}
 
 		// are we done deconstructing the TXN stack?
-		if (this->getActiveTXN(ctx).lock == lock) {
-			if (this->getActiveTXN(ctx).subLock == subLock) {
+		if (activeTXN.lock == lock) {
+			if (activeTXN.subLock == subLock) {
 				// We have deconstructed the TXN stack until the topmost
 				// TXN belongs to the lock for which we have seen a V().
-				m_activeTXNs[ctx].pop_back();
+				this->unindexTXN(activeTXN, ctx);
+				stack.pop_back();
 				found = true;
 				// But still, the TXN stack may contain TXNs belonging to lockPtr.
 				if (removeReader) {
 					// The caller wants to remove all READER_LOCKs from the TXN stack.
-					for (std::deque<TXN>::iterator it = m_activeTXNs[ctx].begin(); it != m_activeTXNs[ctx].end();) {
+					for (auto it = stack.begin(); it != stack.end();) {
 						if (it->lock != lock) {
 							it++;
 							continue;
@@ -163,7 +234,8 @@ bool LockManager::finishTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK s
 						// Does subLock and lockPtr match?
 						if (it->subLock == READER_LOCK) {
 							PRINT_DEBUG(it->lock->toString(it->subLock) << ",ts=" << dec << ts << ",txn=" << it->id, "Flushing TXN");
-							it = m_activeTXNs[ctx].erase(it);
+							this->unindexTXN(*it, ctx);
+							it = stack.erase(it);
 						} else {
 							it++;
 							PRINT_ERROR(it->lock->toString(it->subLock) << ",ts=" << dec << ts, "Multiple active txns for one writer lock");
@@ -172,15 +244,16 @@ bool LockManager::finishTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK s
 				}
 				break;
 			} else {
-				PRINT_ERROR(this->getActiveTXN(ctx).lock->toString(this->getActiveTXN(ctx).subLock) << ",ts=" << dec << ts, "sublock does not match");
+				PRINT_ERROR(activeTXN.lock->toString(activeTXN.subLock) << ",ts=" << dec << ts, "sublock does not match");
 			}
 		}
 
 		// this is a TXN we need to recreate under a different ID after we're done
 
 		// pushing in front to preserve order
-		restartTXNs.push_front(std::move(this->getActiveTXN(ctx)));
-		m_activeTXNs[ctx].pop_back();
+		// The TXN returns to this stack, hence, it stays in the index of its lock.
+		restartTXNs.push_front(std::move(activeTXN));
+		stack.pop_back();
 		// give TXN a new ID + timestamp + memAccessCounter
 		restartTXNs.front().id = m_nextTXNID++;
 		restartTXNs.front().start_ts = ts;
@@ -195,64 +268,61 @@ bool LockManager::finishTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK s
 	}
 
 	// recreate TXNs
-	std::move(restartTXNs.begin(), restartTXNs.end(), std::back_inserter(m_activeTXNs[ctx]));
+	std::move(restartTXNs.begin(), restartTXNs.end(), std::back_inserter(stack));
 	return found;
 
 }
 
+void LockManager::writeLockset(LocksetID lockset) {
+	if (lockset == LOCKSET_EMPTY || !m_locksets.markWritten(lockset)) {
+		return;
+	}
+	for (auto lockID : m_locksets.members(lockset)) {
+		m_locksetsOFile->field(lockset).field(lockID).endRow();
+	}
+}
+
 void LockManager::startTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK subLock, long ctx) {
-	m_activeTXNs[ctx].push_back(TXN());
-	auto& curTXN = this->getActiveTXN(ctx);
+	std::vector<TXN> &stack = this->getStack(ctx).txns;
+	stack.push_back(TXN());
+	auto& curTXN = stack.back();
 	curTXN.id = m_nextTXNID++;
 	curTXN.start_ts = ts;
 	curTXN.start_ctx = ctx;
 	curTXN.memAccessCounter = 0;
 	curTXN.lock = lock;
 	curTXN.subLock = subLock;
+	this->indexTXN(curTXN, ctx);
 }
 
-RWLock* LockManager::allocLock(unsigned long long lockAddress, unsigned allocID, string lockType, const char *lockVarName, unsigned flags) {
+RWLock* LockManager::allocLock(unsigned long long lockAddress, unsigned allocID, SymbolID lockType, const char *lockVarName, unsigned flags) {
 	// Insert virgin lock into map, and write entry to file
 	RWLock *ret;
+	const string &lockTypeName = symbols.get(lockType);
 	
-	if (lockType.compare("raw_spinlock_t") == 0 ||
-		lockType.compare("mutex") == 0 ||
-		lockType.compare(PSEUDOLOCK_NAME_SOFTIRQ) == 0 ||
-		lockType.compare(PSEUDOLOCK_NAME_HARDIRQ) == 0 ||
-		lockType.compare("semaphore") == 0 ||
-		lockType.compare("bit_spin_lock") == 0 ||
-		lockType.compare("sleep mutex") == 0 ||
-		lockType.compare("spin mutex") == 0 ||
-		lockType.compare("kmutex_t") == 0) {	// NetBSD Kernel mutex
-		ret = new WLock(lockAddress, allocID, lockType, lockVarName, flags, this);
-		if (!ret) {
-			PRINT_ERROR("lockAddress=" << showbase << hex << lockAddress << noshowbase, "Cannot allocate WLock.");
-			// This is a severe error. Abort immediately!
-			exit(1);
-		}
-	} else if (lockType.compare(PSEUDOLOCK_NAME_RCU) == 0) {
-		ret = new RLock(lockAddress, allocID, lockType, lockVarName, flags, this);
-		if (!ret) {
-			PRINT_ERROR("lockAddress=" << showbase << hex << lockAddress << noshowbase, "Cannot allocate WLock.");
-			// This is a severe error. Abort immediately!
-			exit(1);
-		}
-	} else if (lockType.compare("rwlock_t") == 0 ||
-			   lockType.compare("rw_semaphore") == 0 ||
-			   lockType.compare("sx") == 0 ||
-			   lockType.compare("rw") == 0 ||
-			   lockType.compare("sleepable rm") == 0 ||
-			   lockType.compare("rm") == 0 ||
-			   lockType.compare("lockmgr") == 0 ||
-			   lockType.compare("krwlock_t") == 0) {	// NetBSD Kernel RW lock
-		ret = new RWLock(lockAddress, allocID, lockType, lockVarName, flags, this);
-		if (!ret) {
-			PRINT_ERROR("lockAddress=" << showbase << hex << lockAddress << noshowbase, "Cannot allocate WLock.");
-			// This is a severe error. Abort immediately!
-			exit(1);
-		}
+	if (lockTypeName.compare("raw_spinlock_t") == 0 ||
+		lockTypeName.compare("mutex") == 0 ||
+		lockTypeName.compare(PSEUDOLOCK_NAME_SOFTIRQ) == 0 ||
+		lockTypeName.compare(PSEUDOLOCK_NAME_HARDIRQ) == 0 ||
+		lockTypeName.compare("semaphore") == 0 ||
+		lockTypeName.compare("bit_spin_lock") == 0 ||
+		lockTypeName.compare("sleep mutex") == 0 ||
+		lockTypeName.compare("spin mutex") == 0 ||
+		lockTypeName.compare("kmutex_t") == 0) {	// NetBSD Kernel mutex
+		ret = new (m_lockPool.allocate()) WLock(lockAddress, allocID, lockType, lockVarName, flags, this);
+	} else if (lockTypeName.compare(PSEUDOLOCK_NAME_RCU) == 0) {
+		ret = new (m_lockPool.allocate()) RLock(lockAddress, allocID, lockType, lockVarName, flags, this);
+	} else if (lockTypeName.compare("rwlock_t") == 0 ||
+			   lockTypeName.compare("rw_semaphore") == 0 ||
+			   lockTypeName.compare("sx") == 0 ||
+			   lockTypeName.compare("rw") == 0 ||
+			   lockTypeName.compare("sleepable rm") == 0 ||
+			   lockTypeName.compare("rm") == 0 ||
+			   lockTypeName.compare("lockmgr") == 0 ||
+			   lockTypeName.compare("krwlock_t") == 0) {	// NetBSD Kernel RW lock
+		ret = new (m_lockPool.allocate()) RWLock(lockAddress, allocID, lockType, lockVarName, flags, this);
 	} else {
-		PRINT_ERROR("lockAddress=" << showbase << hex << lockAddress << noshowbase,"Unknown lock type: " << lockType);
+		PRINT_ERROR("lockAddress=" << showbase << hex << lockAddress << noshowbase,"Unknown lock type: " << lockTypeName);
 		// This is a severe error. Abort immediately!
 		exit(1);
 	}
@@ -3,7 +3,11 @@
 
 #include <deque>
 #include <map>
+#include <vector>
 #include "rwlock.h"
+#include "slaballocator.h"
+#include "addressindex.h"
+#include "lockset.h"
 
 /**
  * Represents a Transaction (TXN).
@@ -25,17 +29,34 @@ struct TXN {
 	enum SUB_LOCK subLock;	
 };
 
+/**
+ * A stack of currently active, nested TXNs of a context.
+ * In Linux terms, a context is irq, softirq, or a task.
+ * A context's id corresponds to a task's tid. For irq and softirq,
+ * we use the artifical ids -2 and -1, respectively.
+ */
+struct TXNStack {
+	long ctx;
+	std::vector<TXN> txns;
+};
+
 struct LockManager {
 	private: 
 	/**
-	 * A stack of currently active, nested TXNs.  Implemented as a deque for mass
-	 * insert() in finishTXN().
-	 * We maintain one stack per context. In Linux terms, a context
-	 * is irq, softirq, or a task.
-	 * A context's id corresponds to a task's tid. For irq and softirq,
-	 * we use the artifical ids -2 and -1, respectively.
+	 * We maintain one stack per context. A stack is created along with the first TXN of its context,
+	 * and is never removed. Hence, pointers to the stacks stay valid.
+	 */
+	std::deque<TXNStack> m_activeTXNs;
+	/**
+	 * Maps a context to its stack
+	 */
+	AddressIndex<TXNStack*> m_ctxIndex;
+	/**
+	 * The context looked up last, and its stack (NULL if it has none yet).
+	 * Consecutive events mostly stem from the same context.
 	 */
-	std::map<long, std::deque<TXN>> m_activeTXNs;
+	long m_cachedCtx;
+	TXNStack *m_cachedStack;
 	/**
 	 * The next id for a new TXN.
 	 */
@@ -48,26 +69,55 @@ struct LockManager {
 	 * Contains all known locks. The ptr of a lock is used as an index.
 	 */
 	std::map<unsigned long long,RWLock*> m_locks;
-	std::ofstream& m_txnsOFile;
-	std::ofstream& m_locksHeldOFile;
+	/**
+	 * Provides the memory for all locks. Locks are constructed in place.
+	 */
+	SlabAllocator m_lockPool;
+	/**
+	 * Locks which have been freed while still being part of a TXN.
+	 * They must outlive the TXN, and are reclaimed along with the LockManager.
+	 */
+	std::vector<RWLock*> m_retiredLocks;
+	/**
+	 * Contains the sets of locks held during the TXNs.
+	 */
+	LocksetTable m_locksets;
+	CSVWriter& m_txnsOFile;
+	CSVWriter *m_locksHeldOFile;								// NULL if locks_held.csv is not written
+	CSVWriter *m_locksetsOFile;									// NULL if locksets.csv is not written
 	void startTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK subLock, long ctx);
 	bool finishTXN(RWLock *lock, unsigned long long ts, enum SUB_LOCK subLock, bool removeReader, long ctx, long ctxOld);
 	long findTXN(RWLock *lck, enum SUB_LOCK subLock, long ctx);
+	bool isPartOfTXN(RWLock *lock);
+	void indexTXN(const TXN &txn, long ctx);
+	void unindexTXN(const TXN &txn, long ctx);
+	void writeLockset(LocksetID lockset);
+	TXNStack* findStack(long ctx);
+	TXNStack& getStack(long ctx);
+	void freeLock(RWLock *lock);
 	public:
 	friend struct RWLock;
-	LockManager(std::ofstream& txnsOFile, std::ofstream& locksHeldOFile) : m_nextTXNID(1), m_nextLockID(1), m_txnsOFile(txnsOFile), m_locksHeldOFile(locksHeldOFile) {
-
-	}
+	/**
+	 * Every finished TXN is written to {@param txnsOFile}, and each lock held during it to {@param locksHeldOFile}.
+	 * If {@param locksetsOFile} is given, a TXN additionally refers to the set of locks held during it,
+	 * and each distinct set is written to {@param locksetsOFile} once.
+	 */
+	LockManager(CSVWriter& txnsOFile, CSVWriter *locksHeldOFile, CSVWriter *locksetsOFile);
+	~LockManager();
 	/**
 	 * Create and init an instance of a new lock
 	 * 
 	 */
-	RWLock* allocLock(unsigned long long lockAddress, unsigned allocID, string lockType, const char *lockVarName, unsigned flags);
+	RWLock* allocLock(unsigned long long lockAddress, unsigned allocID, SymbolID lockType, const char *lockVarName, unsigned flags);
 	/**
 	 * Get top (= current active) TXN
 	 */
 	struct TXN& getActiveTXN(long ctx);
 	bool hasActiveTXN(long ctx);
+	/**
+	 * Get top (= current active) TXN, or NULL if there is none
+	 */
+	struct TXN* activeTXN(long ctx);
 	bool isOnTXNStack(long ctx, RWLock *lock, enum SUB_LOCK subLock);
 	void closeAllTXNs(unsigned long long ts);
 	RWLock* findLock(unsigned long long address);
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include "lockset.h"
+
+using namespace std;
+
+LocksetTable::LocksetTable() {
+	// The empty set
+	m_locksets.push_back({ {}, false });
+	m_ids.emplace(m_locksets.back().members, LOCKSET_EMPTY);
+}
+
+size_t LocksetTable::MembersHash::operator()(const vector<unsigned long long> &members) const {
+	size_t hash = 0xcbf29ce484222325ULL;
+	for (unsigned long long member : members) {
+		hash = (hash ^ member) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+size_t LocksetTable::AdditionHash::operator()(const pair<LocksetID, unsigned long long> &addition) const {
+	return (addition.second * 0x9E3779B97F4A7C15ULL) ^ addition.first;
+}
+
+LocksetID LocksetTable::add(LocksetID lockset, unsigned long long lockID) {
+	auto itAddition = m_additions.find(make_pair(lockset, lockID));
+	if (itAddition != m_additions.end()) {
+		return itAddition->second;
+	}
+
+	LocksetID ret;
+	const vector<unsigned long long> &members = m_locksets[lockset].members;
+	auto pos = lower_bound(members.begin(), members.end(), lockID);
+	if (pos != members.end() && *pos == lockID) {
+		ret = lockset;
+	} else {
+		vector<unsigned long long> extended;
+		extended.reserve(members.size() + 1);
+		extended.insert(extended.end(), members.begin(), pos);
+		extended.push_back(lockID);
+		extended.insert(extended.end(), pos, members.end());
+		auto itID = m_ids.find(extended);
+		if (itID != m_ids.end()) {
+			ret = itID->second;
+		} else {
+			ret = m_locksets.size();
+			m_ids.emplace(extended, ret);
+			m_locksets.push_back({ std::move(extended), false });
+		}
+	}
+	m_additions.emplace(make_pair(lockset, lockID), ret);
+	return ret;
+}
+
+bool LocksetTable::markWritten(LocksetID lockset) {
+	if (m_locksets[lockset].written) {
+		return false;
+	}
+	m_locksets[lockset].written = true;
+	return true;
+}
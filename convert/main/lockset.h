@@ -0,0 +1,55 @@
+#ifndef __LOCKSET_H__
+#define __LOCKSET_H__
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * Identifies an interned set of locks. The empty set is LOCKSET_EMPTY.
+ */
+typedef uint32_t LocksetID;
+#define LOCKSET_EMPTY 0
+
+/**
+ * Interns sets of (sub) lock IDs, i.e., the locks held during a TXN.
+ * Each distinct set is stored once, and is identified by a LocksetID.
+ * A set is built up lock by lock with add(). Adding a lock to a set is memoized,
+ * so that rebuilding a set which has been seen before only costs one hash lookup per lock.
+ */
+struct LocksetTable {
+	LocksetTable();
+	/**
+	 * Returns the set {@param lockset} plus the lock {@param lockID}.
+	 * If the lock is already a member, {@param lockset} itself is returned.
+	 */
+	LocksetID add(LocksetID lockset, unsigned long long lockID);
+	/**
+	 * The members of {@param lockset} in ascending order
+	 */
+	const std::vector<unsigned long long>& members(LocksetID lockset) const {
+		return m_locksets[lockset].members;
+	}
+	/**
+	 * Returns true if {@param lockset} has not been written yet, and remembers that it has been written now.
+	 */
+	bool markWritten(LocksetID lockset);
+
+	private:
+	struct Lockset {
+		std::vector<unsigned long long> members;
+		bool written;
+	};
+	struct MembersHash {
+		size_t operator()(const std::vector<unsigned long long> &members) const;
+	};
+	struct AdditionHash {
+		size_t operator()(const std::pair<LocksetID, unsigned long long> &addition) const;
+	};
+
+	std::vector<Lockset> m_locksets;							// Indexed by LocksetID
+	std::unordered_map<std::vector<unsigned long long>, LocksetID, MembersHash> m_ids;
+	std::unordered_map<std::pair<LocksetID, unsigned long long>, LocksetID, AdditionHash> m_additions;	// Memoized results of add()
+};
+
+#endif // __LOCKSET_H__
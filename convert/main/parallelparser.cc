@@ -0,0 +1,183 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "parallelparser.h"
+
+using namespace std;
+
+ParallelCSVParser::ParallelCSVParser(TraceReader *reader, char delimiter, bool ctxTracing, unsigned threads) :
+	m_reader(reader), m_delimiter(delimiter), m_ctxTracing(ctxTracing), m_nextChunk(0), m_consumed(0),
+	m_stop(false), m_eof(false), m_failed(false), m_current(NULL), m_event(0), m_reparse(0), m_done(false) {
+	m_chunks.resize(threads * PARSE_CHUNKS_PER_THREAD);
+	for (auto &chunk : m_chunks) {
+		chunk.state = CHUNK_FREE;
+	}
+	for (unsigned i = 0; i < threads; i++) {
+		m_workers.emplace_back(&ParallelCSVParser::worker, this);
+	}
+}
+
+ParallelCSVParser::~ParallelCSVParser() {
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_stop = true;
+	}
+	m_chunkFreed.notify_all();
+	for (auto &worker : m_workers) {
+		worker.join();
+	}
+}
+
+void ParallelCSVParser::worker() {
+	Chunk *chunk;
+
+	while (1) {
+		{
+			// Chunks are read one after the other, so that they are numbered in the order of the trace.
+			lock_guard<mutex> readGuard(m_readLock);
+			unique_lock<mutex> guard(m_lock);
+			// Do not run more than m_chunks.size() chunks ahead of the consumer
+			m_chunkFreed.wait(guard, [this] {
+				return m_stop || m_eof || m_chunks[m_nextChunk % m_chunks.size()].state == CHUNK_FREE; });
+			if (m_stop || m_eof) {
+				break;
+			}
+			chunk = &m_chunks[m_nextChunk % m_chunks.size()];
+			chunk->state = CHUNK_PARSING;
+			chunk->index = m_nextChunk++;
+			guard.unlock();
+
+			readChunk(*chunk);
+			if (chunk->last) {
+				guard.lock();
+				m_eof = true;
+			}
+		}
+		parseChunk(*chunk);
+		{
+			lock_guard<mutex> guard(m_lock);
+			chunk->state = CHUNK_PARSED;
+		}
+		m_chunkParsed.notify_all();
+	}
+}
+
+void ParallelCSVParser::readChunk(Chunk &chunk) {
+	size_t carried, bytes;
+
+	// Start with the partial line left over by the previous chunk
+	chunk.data.swap(m_carry);
+	m_carry.clear();
+	carried = chunk.data.size();
+	chunk.data.resize(carried + PARSE_CHUNK_SIZE);
+	bytes = m_reader->read(chunk.data.data() + carried, PARSE_CHUNK_SIZE);
+	chunk.data.resize(carried + bytes);
+	chunk.last = bytes < PARSE_CHUNK_SIZE;
+	if (chunk.last) {
+		return;
+	}
+	// Cut the chunk after its last complete line. The remainder is carried over to the next chunk.
+	// A chunk without any newline is carried over as a whole, and ends up empty.
+	const char *end = (const char*)memrchr(chunk.data.data(), '\n', chunk.data.size());
+	size_t len = end != NULL ? end - chunk.data.data() + 1 : 0;
+	m_carry.assign(chunk.data.begin() + len, chunk.data.end());
+	chunk.data.resize(len);
+}
+
+void ParallelCSVParser::parseChunk(Chunk &chunk) {
+	string_view data(chunk.data.data(), chunk.data.size()), line;
+	size_t pos = 0, end;
+	TraceEvent event;
+	ostringstream err;
+	unsigned char assigned = 0;
+	bool firstLine = chunk.index == 0;
+
+	chunk.events.clear();
+	chunk.reparse.clear();
+	chunk.noHeader = false;
+	while (pos < data.size()) {
+		end = data.find('\n', pos);
+		if (end == string_view::npos) {
+			end = data.size();
+		}
+		line = data.substr(pos, end - pos);
+		pos = end + 1;
+		// Skip the header if there is one.  This check exploits the fact that
+		// any valid input line must start with a decimal digit.
+		if (firstLine) {
+			firstLine = false;
+			if (line.length() == 0 || !isdigit(line[0])) {
+				continue;
+			}
+			chunk.noHeader = true;
+		}
+		bool ok = parseCSVEvent(line, m_delimiter, m_ctxTracing, event, err);
+		// The diagnostics depend on the formatting state of cerr, which only the consumer knows.
+		if (err.tellp() > 0) {
+			chunk.reparse.push_back({chunk.events.size(), line});
+			err.str("");
+		}
+		if (!ok) {
+			break;
+		}
+		// Members assigned by any previous event of this chunk are valid as well.
+		// All others have to be inherited from the previous chunk by the consumer.
+		assigned |= event.assigned;
+		event.assigned = assigned;
+		chunk.events.push_back(event);
+	}
+}
+
+bool ParallelCSVParser::nextEvent(TraceEvent &event) {
+	while (1) {
+		if (m_current == NULL) {
+			if (m_done) {
+				return false;
+			}
+			unique_lock<mutex> guard(m_lock);
+			Chunk &chunk = m_chunks[m_consumed % m_chunks.size()];
+			m_chunkParsed.wait(guard, [&chunk] { return chunk.state == CHUNK_PARSED; });
+			m_current = &chunk;
+			m_event = m_reparse = 0;
+			if (chunk.noHeader) {
+				cerr << "Warning: Input data does not start with a CSV header." << endl;
+			}
+		}
+
+		Chunk &chunk = *m_current;
+		if (m_reparse < chunk.reparse.size() && chunk.reparse[m_reparse].event == m_event) {
+			// Parse the line exactly like the sequential path does, printing the same diagnostics.
+			if (!parseCSVEvent(chunk.reparse[m_reparse].line, m_delimiter, m_ctxTracing, event, cerr)) {
+				m_failed = true;
+				return false;
+			}
+			m_reparse++;
+			m_event++;
+			return true;
+		}
+		if (m_event < chunk.events.size()) {
+			TraceEvent &next = chunk.events[m_event++];
+			if (!(next.assigned & TRACE_EVENT_ACTION)) {
+				next.action = event.action;
+			}
+			if (!(next.assigned & TRACE_EVENT_LOCK_OP)) {
+				next.lockOP = event.lockOP;
+			}
+			if (!(next.assigned & TRACE_EVENT_CTX)) {
+				next.ctx = event.ctx;
+			}
+			event = next;
+			return true;
+		}
+		// The chunk is exhausted. Hand it back to the workers.
+		m_done = chunk.last;
+		m_current = NULL;
+		{
+			lock_guard<mutex> guard(m_lock);
+			chunk.state = CHUNK_FREE;
+			m_consumed++;
+		}
+		m_chunkFreed.notify_all();
+	}
+}
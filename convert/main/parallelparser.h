@@ -0,0 +1,84 @@
+#ifndef __PARALLELPARSER_H__
+#define __PARALLELPARSER_H__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tracereader.h"
+
+#define PARSE_CHUNK_SIZE			(1 << 20)		// Bytes of the trace parsed by a worker at once
+#define PARSE_CHUNKS_PER_THREAD		4				// Chunks in flight per worker
+
+/**
+ * Parses a CSV trace on a pool of worker threads.
+ * The trace is split at line boundaries into chunks, and each worker turns a whole chunk into TraceEvents.
+ * The events are handed out in their original order by nextEvent(), which is meant to be called by a single consumer.
+ * Lines parseCSVEvent() complains about are parsed once more by the consumer, right before they are handed out.
+ * Hence, the consumer observes exactly the same sequence of events and messages as if it parsed the trace itself.
+ */
+struct ParallelCSVParser {
+	/**
+	 * Parse the trace read by {@param reader} with {@param threads} workers.
+	 * The parser does not take the ownership of {@param reader}.
+	 */
+	ParallelCSVParser(TraceReader *reader, char delimiter, bool ctxTracing, unsigned threads);
+	~ParallelCSVParser();
+	/**
+	 * Store the next event in {@param event}, which has to hold the previous event.
+	 * Like parseCSVEvent(), members an event does not set are inherited from the previous one.
+	 * Returns false at the end of the trace, or if parsing failed. failed() tells them apart.
+	 */
+	bool nextEvent(TraceEvent &event);
+	bool failed() const {
+		return m_failed;
+	}
+
+	private:
+	enum CHUNK_STATE {
+		CHUNK_FREE = 0,												// May be filled with the next chunk of the trace
+		CHUNK_PARSING,												// A worker is busy with it
+		CHUNK_PARSED												// Ready for the consumer
+	};
+	struct Reparse {
+		size_t event;												// Index of the event within its chunk
+		std::string_view line;
+	};
+	struct Chunk {
+		enum CHUNK_STATE state;
+		size_t index;												// Position of the chunk within the trace
+		std::vector<char> data;										// The lines. The events point into them.
+		std::vector<TraceEvent> events;
+		std::vector<Reparse> reparse;								// Lines to be parsed by the consumer, which prints their diagnostics.
+																	// If the last one cannot be parsed at all, the chunk ends with it.
+		bool noHeader;												// The trace does not start with a CSV header
+		bool last;													// No chunk follows
+	};
+
+	TraceReader *m_reader;
+	char m_delimiter;
+	bool m_ctxTracing;
+	std::vector<Chunk> m_chunks;								// Ring of chunks in flight, indexed by index % size
+	std::vector<std::thread> m_workers;
+	std::mutex m_lock;											// Protects the chunk states and the counters
+	std::condition_variable m_chunkParsed;						// Signalled by workers
+	std::condition_variable m_chunkFreed;						// Signalled by the consumer
+	size_t m_nextChunk;											// Index of the next chunk to be read
+	size_t m_consumed;											// Index of the chunk the consumer takes events from
+	bool m_stop;												// Tells the workers to quit
+	bool m_eof;													// The whole trace has been read
+	bool m_failed;
+	std::mutex m_readLock;										// Serializes reading chunks of the trace
+	std::vector<char> m_carry;									// Partial line at the end of the last chunk read
+	Chunk *m_current;											// Chunk the consumer takes events from, or NULL
+	size_t m_event;												// Next event of the current chunk
+	size_t m_reparse;											// Next line of the current chunk to be reparsed
+	bool m_done;												// The consumer has seen the last chunk
+
+	void worker();
+	void readChunk(Chunk &chunk);
+	void parseChunk(Chunk &chunk);
+};
+
+#endif // __PARALLELPARSER_H__
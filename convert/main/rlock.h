@@ -7,7 +7,7 @@
 using std::dec;
 
 struct RLock : public RWLock {
-	RLock (unsigned long long _lockAddress, unsigned _allocID, std::string _lockType, const char *_lockVarName, unsigned _flags, LockManager *_lockManager) : RWLock(_lockAddress, _allocID, _lockType, _lockVarName, _flags, _lockManager) {
+	RLock (unsigned long long _lockAddress, unsigned _allocID, SymbolID _lockType, const char *_lockVarName, unsigned _flags, LockManager *_lockManager) : RWLock(_lockAddress, _allocID, _lockType, _lockVarName, _flags, _lockManager) {
 			
 	}
 
@@ -31,20 +31,19 @@ struct RLock : public RWLock {
 		throw invalid_argument("ID for writer sub lock requested.");
 	}
 
-	virtual void writeLock(std::ofstream &oFile, char delimiter) {
-		this->writeReaderLock(oFile, delimiter);
+	virtual void writeLock(CSVWriter &oFile) {
+		this->writeReaderLock(oFile);
 	}
 
 	void transition(
 	enum LOCK_OP lockOP,
 	unsigned long long ts,
-	std::string const& file,
+	SymbolID file,
 	unsigned long long line,
-	string const& lockMember,
+	SymbolID lockMember,
 	unsigned flags,
-	const char *kernelDir,
 	long ctx) {
-		RWLock::readTransition(lockOP, ts, file, line, lockMember, flags, kernelDir, ctx);
+		RWLock::readTransition(lockOP, ts, file, line, lockMember, flags, ctx);
 	}
 };
 
@@ -11,11 +11,10 @@
 void RWLock::writeTransition(
 	enum LOCK_OP lockOP,
 	unsigned long long ts,
-	std::string const& file,
+	SymbolID file,
 	unsigned long long line,
-	string const& lockMember,
+	SymbolID lockMember,
 	unsigned flags,
-	const char *kernelDir,
 	long ctx) {
 	long ctxOld = ctx;
 
@@ -71,15 +70,7 @@ void RWLock::writeTransition(
 				tempLockPos.subLock = WRITER_LOCK;
 				tempLockPos.start = ts;
 				tempLockPos.lastLine = line;
-				string tmp = kernelDir;
-				if (tmp.back() != '/') {
-					tmp.append("/");
-				}
-				if (file.find(tmp) != string::npos) {
-					tempLockPos.lastFile = file.substr(tmp.length());
-				} else {
-					tempLockPos.lastFile = file;
-				}
+				tempLockPos.lastFile = file;
 
 				PRINT_DEBUG(this->toString(WRITER_LOCK, lockOP, ts), "P_WRITE in ctx " << ctx);
 				// a P() suspends the current TXN and creates a new one
@@ -137,11 +128,10 @@ void RWLock::writeTransition(
 void RWLock::readTransition(
 	enum LOCK_OP lockOP,
 	unsigned long long ts,
-	std::string const& file,
+	SymbolID file,
 	unsigned long long line,
-	string const& lockMember,
+	SymbolID lockMember,
 	unsigned flags,
-	const char *kernelDir,
 	long ctx) {
 	long ctxOld = ctx;
 
@@ -192,15 +182,7 @@ void RWLock::readTransition(
 				tempLockPos.subLock = READER_LOCK;
 				tempLockPos.start = ts;
 				tempLockPos.lastLine = line;
-				string tmp = kernelDir;
-				if (tmp.back() != '/') {
-					tmp.append("/");
-				}
-				if (file.find(tmp) != string::npos) {
-					tempLockPos.lastFile = file.substr(tmp.length());
-				} else {
-					tempLockPos.lastFile = file;
-				}
+				tempLockPos.lastFile = file;
 				PRINT_DEBUG(this->toString(READER_LOCK, lockOP, ts), "P_READ in ctx " << ctx);
 
 				// a P() suspends the current TXN and creates a new one
@@ -7,10 +7,13 @@
 #include <sstream>
 #include <iostream>
 #include <deque>
+#include <map>
 #include <stack>
 #include <typeinfo>
 #include <cxxabi.h>
 #include "lockdoc_event.h"
+#include "symboltable.h"
+#include "csvwriter.h"
 
 using namespace std;
 
@@ -23,39 +26,9 @@ struct LockPos {
 	enum SUB_LOCK subLock;										// Which side of the lock (reader or write) has been acquired
 	unsigned long long start;									// Timestamp when the lock has been acquired
 	int lastLine;												// Position within the file where the lock has been acquired for the last time
-	std::string lastFile;											// Last file from where the lock has been acquired
+	SymbolID lastFile;											// Last file from where the lock has been acquired, relative to the kernel source tree
 };
 
-
-// Must be definied here, because the lock subclasses need it.
-// returns stringified var if cond is false, or "NULL" if cond is true
-template <typename T>
-static inline std::string sql_null_if(T var, bool cond)
-{
-	if (!cond) {
-		return std::to_string(var);
-	}
-	return "\\N";
-}
-
-template <>
-inline std::string sql_null_if<const char*>(const char *var, bool cond)
-{
-    if (!cond) {
-        return std::string(var);
-    }   
-    return "\\N";
-}
-
-template <>
-inline std::string sql_null_if<std::string>(std::string var, bool cond)
-{
-    if (!cond) {
-        return var;
-    }   
-    return "\\N";
-}
-
 /**
  * Describes an instance of a lock. In our model every lock is a reader-writer lock.
  * It internally consists of two so-called sub locks, a writer and a reader sub lock.
@@ -71,12 +44,14 @@ struct RWLock {
 	int reader_count;											// Indicates whether the lock is held or not (may be > 1 for recursive locks)
 	int writer_count;											// Indicates whether the lock is held or not (0 or 1)
 	unsigned allocation_id;										// ID of the allocation this lock resides in (0 if not embedded)
-	std::string lockType;										// Describes the lock type
+	SymbolID lockType;											// Describes the lock type
 	std::string lockVarName;									// The variable name of the lock, e.g., console_sem, if static (allocation_id == 0)
 	std::stack<LockPos> lastNPos;								// Last N takes of this lock, max. one element besides for recursive locks (such as RCU)
+	std::map<long, unsigned> txnContexts[2];					// Per sub lock: The contexts whose TXN stack contains this lock, and how often.
+																// Maintained by the LockManager.
 	LockManager *lockManager;
 	
-	RWLock (unsigned long long _lockAddress, unsigned _allocID, std::string _lockType, const char *_lockVarName, unsigned _flags, LockManager *_lockManager) : 
+	RWLock (unsigned long long _lockAddress, unsigned _allocID, SymbolID _lockType, const char *_lockVarName, unsigned _flags, LockManager *_lockManager) : 
 		lockAddress(_lockAddress), flags(_flags), reader_count(0), writer_count(0), 
 		allocation_id(_allocID), lockType(_lockType), lockManager(_lockManager) {
 		if (_lockVarName) {
@@ -84,6 +59,8 @@ struct RWLock {
 		}
 	};
 
+	virtual ~RWLock() { }
+
 	/**
 	 * Convert a SUB_LOCK to a humand-readable string
 	 * 
@@ -204,12 +181,11 @@ struct RWLock {
 	}
 
 	/**
-	 * Write this lock's information to {@param oFile} using {@param delimiter}
-	 * as separator between each data. 
+	 * Write this lock's information to {@param oFile}.
 	 */
-	virtual void writeLock(std::ofstream &oFile, char delimiter) {
-		this->writeWriterLock(oFile, delimiter);
-		this->writeReaderLock(oFile, delimiter);
+	virtual void writeLock(CSVWriter &oFile) {
+		this->writeWriterLock(oFile);
+		this->writeReaderLock(oFile);
 	}
 
 	/**
@@ -220,19 +196,18 @@ struct RWLock {
 	virtual void transition(
 	enum LOCK_OP lockOP,
 	unsigned long long ts,
-	std::string const& file,
+	SymbolID file,
 	unsigned long long line,
-	string const& lockMember,
+	SymbolID lockMember,
 	unsigned flags,
-	const char *kernelDir,
 	long ctx) {
 		if (lockOP == P_WRITE || lockOP == V_WRITE) {
-			writeTransition(lockOP, ts, file, line, lockMember, flags, kernelDir, ctx);
+			writeTransition(lockOP, ts, file, line, lockMember, flags, ctx);
 		} else if (lockOP == P_READ || lockOP == V_READ) {
-			readTransition(lockOP, ts, file, line, lockMember, flags, kernelDir, ctx);
+			readTransition(lockOP, ts, file, line, lockMember, flags, ctx);
 		} else {
 			stringstream ss;
-			ss << "Invalid op(" << lockOP << "," << hex << showbase << this->lockAddress << noshowbase << "," << lockMember << ") at ts " << ts << endl;
+			ss << "Invalid op(" << lockOP << "," << hex << showbase << this->lockAddress << noshowbase << "," << symbols.get(lockMember) << ") at ts " << ts << endl;
 			throw logic_error(ss.str());
 		}
 	}
@@ -246,11 +221,10 @@ struct RWLock {
 	void writeTransition(
 	enum LOCK_OP lockOP,
 	unsigned long long ts,
-	std::string const& file,
+	SymbolID file,
 	unsigned long long line,
-	string const& lockMember,
+	SymbolID lockMember,
 	unsigned flags,
-	const char *kernelDir,
 	long ctx);
 
 	/**
@@ -261,25 +235,24 @@ struct RWLock {
 	void readTransition(
 	enum LOCK_OP lockOP,
 	unsigned long long ts,
-	std::string const& file,
+	SymbolID file,
 	unsigned long long line,
-	string const& lockMember,
+	SymbolID lockMember,
 	unsigned flags,
-	const char *kernelDir,
 	long ctx);
 
-	virtual void writeWriterLock(std::ofstream &oFile, char delimiter) {
-		oFile << dec << write_id << delimiter << lockAddress;
-		oFile << delimiter << sql_null_if(allocation_id, allocation_id == 0) << delimiter << lockType << delimiter;
-		oFile << 'w' << delimiter << sql_null_if(lockVarName, lockVarName.empty()) << delimiter;
-		oFile << flags << "\n";
+	virtual void writeWriterLock(CSVWriter &oFile) {
+		oFile.field(write_id).field(lockAddress);
+		oFile.nullIf(allocation_id, allocation_id == 0).field(symbols.get(lockType)).field('w');
+		oFile.nullIf(lockVarName, lockVarName.empty()).field(flags);
+		oFile.endRow();
 	}
 
-	virtual void writeReaderLock(std::ofstream &oFile, char delimiter) {
-		oFile << dec << read_id << delimiter << lockAddress;
-		oFile << delimiter << sql_null_if(allocation_id, allocation_id == 0) << delimiter << lockType << delimiter;
-		oFile << 'r' << delimiter << sql_null_if(lockVarName, lockVarName.empty()) << delimiter;
-		oFile << flags << "\n";
+	virtual void writeReaderLock(CSVWriter &oFile) {
+		oFile.field(read_id).field(lockAddress);
+		oFile.nullIf(allocation_id, allocation_id == 0).field(symbols.get(lockType)).field('r');
+		oFile.nullIf(lockVarName, lockVarName.empty()).field(flags);
+		oFile.endRow();
 	}
 };
 
@@ -0,0 +1,54 @@
+#ifndef __SLABALLOCATOR_H__
+#define __SLABALLOCATOR_H__
+
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+#include <memory>
+
+#define SLAB_OBJECTS				256				// Objects carved out of one slab
+
+/**
+ * Hands out memory for objects of at most {@param objectSize} bytes, which are carved out of larger slabs.
+ * Released objects are kept on a free list, and are handed out again before a new slab is allocated.
+ * Hence, the memory footprint is bounded by the maximum number of objects alive at the same time.
+ * The allocator does not construct or destruct objects. The slabs are freed along with the allocator.
+ */
+struct SlabAllocator {
+	SlabAllocator(size_t objectSize) : m_freeList(NULL), m_next(SLAB_OBJECTS) {
+		// Every object has to be able to hold the free list pointer, and has to be suitably aligned.
+		m_objectSize = std::max(objectSize, sizeof(FreeObject));
+		m_objectSize = (m_objectSize + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+	}
+
+	void* allocate() {
+		if (m_freeList) {
+			FreeObject *ret = m_freeList;
+			m_freeList = ret->next;
+			return ret;
+		}
+		if (m_next == SLAB_OBJECTS) {
+			m_slabs.emplace_back(new char[m_objectSize * SLAB_OBJECTS]);
+			m_next = 0;
+		}
+		return m_slabs.back().get() + m_objectSize * m_next++;
+	}
+
+	void release(void *obj) {
+		FreeObject *freed = static_cast<FreeObject*>(obj);
+		freed->next = m_freeList;
+		m_freeList = freed;
+	}
+
+	private:
+	struct FreeObject {
+		FreeObject *next;
+	};
+
+	size_t m_objectSize;										// Size of an object including padding
+	std::vector<std::unique_ptr<char[]>> m_slabs;
+	FreeObject *m_freeList;										// Released objects
+	size_t m_next;												// Next untouched object in the last slab
+};
+
+#endif // __SLABALLOCATOR_H__
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <charconv>
+#include <algorithm>
+#include "config.h"
+#include "stacktracetable.h"
+
+using namespace std;
+
+static inline uint64_t hashFrame(uint64_t hash, uint64_t frame) {
+	return (hash ^ frame) * 0x100000001b3ULL;
+}
+
+StacktraceTable::StacktraceTable() : m_slots(STACKTRACE_TABLE_INITIAL_SLOTS) {
+}
+
+unsigned long long StacktraceTable::intern(uint64_t instrPtr, string_view returnAddresses, bool &added) {
+	uint64_t hash = hashFrame(0xcbf29ce484222325ULL, instrPtr);
+
+	m_frames.clear();
+	m_frames.push_back(instrPtr);
+	// Each address is followed by a comma, but the last comma may be missing. Empty tokens are skipped.
+	const char *pos = returnAddresses.data(), *end = pos + returnAddresses.size();
+	while (pos < end) {
+		const char *comma = find(pos, end, ',');
+		const char *digits = pos;
+		if (comma - digits > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+			digits += 2;
+		}
+		if (comma > pos) {
+			uint64_t frame;
+			auto res = from_chars(digits, comma, frame, 16);
+			if (res.ec != errc() || res.ptr != comma) {
+				PRINT_ERROR("stacktrace=" << returnAddresses, "Skipping invalid return address: " << string_view(pos, comma - pos));
+			} else {
+				m_frames.push_back(frame);
+				hash = hashFrame(hash, frame);
+			}
+		}
+		pos = comma + 1;
+	}
+	// Addresses mostly differ in their low bits, which only propagate upwards during multiplication.
+	hash ^= hash >> 32;
+
+	size_t mask = m_slots.size() - 1;
+	size_t slot;
+	for (slot = hash & mask; m_slots[slot] != 0; slot = (slot + 1) & mask) {
+		const Stacktrace &stacktrace = m_stacktraces[m_slots[slot] - 1];
+		if (stacktrace.hash == hash && stacktrace.length == m_frames.size() &&
+			equal(m_frames.begin(), m_frames.end(), m_pool.begin() + stacktrace.offset)) {
+			added = false;
+			return m_slots[slot];
+		}
+	}
+
+	m_stacktraces.push_back({ hash, m_pool.size(), m_frames.size() });
+	m_pool.insert(m_pool.end(), m_frames.begin(), m_frames.end());
+	m_slots[slot] = m_stacktraces.size();
+	added = true;
+	unsigned long long ret = m_stacktraces.size();
+	// Keep the load factor below one half
+	if (2 * m_stacktraces.size() > m_slots.size()) {
+		grow();
+	}
+	return ret;
+}
+
+void StacktraceTable::grow() {
+	m_slots.assign(2 * m_slots.size(), 0);
+	size_t mask = m_slots.size() - 1;
+	for (size_t i = 0; i < m_stacktraces.size(); i++) {
+		size_t slot;
+		for (slot = m_stacktraces[i].hash & mask; m_slots[slot] != 0; slot = (slot + 1) & mask);
+		m_slots[slot] = i + 1;
+	}
+}
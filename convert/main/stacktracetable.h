@@ -0,0 +1,61 @@
+#ifndef __STACKTRACETABLE_H__
+#define __STACKTRACETABLE_H__
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#define STACKTRACE_TABLE_INITIAL_SLOTS	1024			// Must be a power of two
+
+/**
+ * Interns stacktraces, i.e., the instruction pointer of a memory access and its return addresses.
+ * The return addresses are parsed once into frames. A whole stacktrace is then looked up by its frames
+ * in an open-addressing hash table, which stores the hash of each entry, and only compares the frames
+ * of an entry with the same hash. The frames of all stacktraces reside in one pool.
+ * Hence, a stacktrace which has been seen before costs one lookup, and no allocation at all.
+ */
+struct StacktraceTable {
+	StacktraceTable();
+	/**
+	 * Returns the ID of the stacktrace consisting of {@param instrPtr} and the comma-separated, hexadecimal
+	 * return addresses {@param returnAddresses}. IDs are assigned in ascending order, starting at 1.
+	 * Sets {@param added} if the stacktrace has not been seen before. Its frames() have to be written then.
+	 */
+	unsigned long long intern(uint64_t instrPtr, std::string_view returnAddresses, bool &added);
+	/**
+	 * The frames of the stacktrace last passed to intern(), starting with its instruction pointer
+	 */
+	const std::vector<uint64_t>& frames() const {
+		return m_frames;
+	}
+	/**
+	 * The number of stacktraces, i.e., the highest ID
+	 */
+	size_t size() const {
+		return m_stacktraces.size();
+	}
+	/**
+	 * The frames of the stacktrace with the ID {@param id}. Stores their number in {@param length}.
+	 */
+	const uint64_t* frames(unsigned long long id, size_t &length) const {
+		const Stacktrace &stacktrace = m_stacktraces[id - 1];
+		length = stacktrace.length;
+		return m_pool.data() + stacktrace.offset;
+	}
+
+	private:
+	struct Stacktrace {
+		uint64_t hash;
+		size_t offset;												// Index of its first frame in m_pool
+		size_t length;												// Number of frames
+	};
+
+	std::vector<uint64_t> m_frames;								// Frames of the stacktrace being looked up
+	std::vector<uint64_t> m_pool;								// Frames of all stacktraces, back to back
+	std::vector<Stacktrace> m_stacktraces;						// Indexed by ID - 1
+	std::vector<uint32_t> m_slots;								// Hash table with linear probing. Holds IDs, 0 is an empty slot.
+
+	void grow();
+};
+
+#endif // __STACKTRACETABLE_H__
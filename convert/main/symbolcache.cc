@@ -0,0 +1,199 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "symbolcache.h"
+
+using namespace std;
+
+/**
+ * Reads the fields of the records, and tells whether the buffer has been exhausted.
+ */
+struct RecordReader {
+	RecordReader(const string &buffer, size_t pos) : m_buffer(buffer), m_pos(pos) { }
+
+	bool read(void *dst, size_t length) {
+		if (m_buffer.size() - m_pos < length) {
+			return false;
+		}
+		memcpy(dst, m_buffer.data() + m_pos, length);
+		m_pos += length;
+		return true;
+	}
+	bool readString(const char *&str, size_t &length) {
+		uint16_t len;
+		if (!read(&len, sizeof(len)) || m_buffer.size() - m_pos < len) {
+			return false;
+		}
+		str = m_buffer.data() + m_pos;
+		length = len;
+		m_pos += len;
+		return true;
+	}
+	size_t pos() const {
+		return m_pos;
+	}
+
+	private:
+	const string &m_buffer;
+	size_t m_pos;
+};
+
+static void append(string &buffer, const void *src, size_t length) {
+	buffer.append((const char*)src, length);
+}
+
+static void appendString(string &buffer, const char *str) {
+	uint16_t len = min(strlen(str), (size_t)UINT16_MAX);
+	append(buffer, &len, sizeof(len));
+	append(buffer, str, len);
+}
+
+static void appendLocation(string &buffer, const CodeLocation &location) {
+	int32_t line = location.line;
+	append(buffer, &line, sizeof(line));
+	appendString(buffer, location.fn);
+	appendString(buffer, location.file);
+}
+
+const char* SymbolCache::intern(const char *str, size_t length) {
+	return m_strings.emplace(str, length).first->c_str();
+}
+
+size_t SymbolCache::load(const char *cacheName, const string &buildId, const char *compDir, const char *resolver, map<uint64_t, ResolvedInstructionPtr> &resolved) {
+	m_enabled = true;
+	m_rewrite = true;
+	m_name = cacheName;
+	m_key = buildId;
+	m_key.push_back('\0');
+	m_key.append(compDir);
+	m_key.push_back('\0');
+	m_key.append(resolver);
+
+	int fd = open(cacheName, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	// save() of a conversion running in parallel may truncate the file, and rewrite it.
+	flock(fd, LOCK_SH);
+	string buffer;
+	char chunk[1 << 16];
+	ssize_t ret;
+	while ((ret = read(fd, chunk, sizeof(chunk))) > 0) {
+		buffer.append(chunk, ret);
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	if (ret < 0) {
+		perror("read symbol cache");
+		return 0;
+	}
+
+	uint32_t keyLength;
+	size_t magicLength = strlen(SYMBOL_CACHE_MAGIC);
+	if (buffer.compare(0, magicLength, SYMBOL_CACHE_MAGIC) != 0 || buffer.size() < magicLength + sizeof(keyLength)) {
+		cerr << "Ignoring invalid symbol cache: " << cacheName << endl;
+		return 0;
+	}
+	memcpy(&keyLength, buffer.data() + magicLength, sizeof(keyLength));
+	if (buffer.compare(magicLength + sizeof(keyLength), keyLength, m_key) != 0) {
+		cerr << "Ignoring symbol cache of another vmlinux, kernel source tree, or resolver: " << cacheName << endl;
+		return 0;
+	}
+
+	RecordReader reader(buffer, magicLength + sizeof(keyLength) + keyLength);
+	size_t records = 0;
+	while (reader.pos() < buffer.size()) {
+		uint64_t addr;
+		uint32_t count;
+		ResolvedInstructionPtr entry;
+		bool complete = reader.read(&addr, sizeof(addr)) && reader.read(&count, sizeof(count)) && count > 0;
+		for (uint32_t i = 0; complete && i < count; i++) {
+			int32_t line;
+			const char *fn, *file;
+			size_t fnLength, fileLength;
+			complete = reader.read(&line, sizeof(line)) && reader.readString(fn, fnLength) && reader.readString(file, fileLength);
+			if (complete) {
+				CodeLocation location = { intern(fn, fnLength), intern(file, fileLength), line };
+				if (i == 0) {
+					entry.codeLocation = location;
+				} else {
+					entry.inlinedBy.push_back(location);
+				}
+			}
+		}
+		if (!complete) {
+			// E.g., another run has crashed while appending. Appending to a torn record would make the rest unreadable.
+			cerr << "Ignoring torn record at the end of the symbol cache: " << cacheName << endl;
+			return records;
+		}
+		if (resolved.emplace(addr, move(entry)).second) {
+			m_loaded.push_back(addr);
+		}
+		records++;
+	}
+	sort(m_loaded.begin(), m_loaded.end());
+	m_rewrite = false;
+	return records;
+}
+
+long SymbolCache::save(const map<uint64_t, ResolvedInstructionPtr> &resolved) {
+	string buffer;
+	long records = 0;
+
+	if (!m_enabled) {
+		return 0;
+	}
+	if (m_rewrite) {
+		uint32_t keyLength = m_key.size();
+		buffer.append(SYMBOL_CACHE_MAGIC);
+		append(buffer, &keyLength, sizeof(keyLength));
+		buffer.append(m_key);
+	}
+	for (const auto &it : resolved) {
+		if (!m_rewrite && binary_search(m_loaded.begin(), m_loaded.end(), it.first)) {
+			continue;
+		}
+		uint32_t count = 1 + it.second.inlinedBy.size();
+		append(buffer, &it.first, sizeof(it.first));
+		append(buffer, &count, sizeof(count));
+		appendLocation(buffer, it.second.codeLocation);
+		for (const auto &location : it.second.inlinedBy) {
+			appendLocation(buffer, location);
+		}
+		records++;
+	}
+	if (records == 0 && !m_rewrite) {
+		return 0;
+	}
+
+	int fd = open(m_name.c_str(), O_WRONLY | O_CREAT | (m_rewrite ? 0 : O_APPEND), 0644);
+	if (fd < 0) {
+		perror("open symbol cache");
+		return -1;
+	}
+	// Conversions running in parallel must not interleave their records.
+	flock(fd, LOCK_EX);
+	if (m_rewrite && ftruncate(fd, 0) != 0) {
+		perror("truncate symbol cache");
+		flock(fd, LOCK_UN);
+		close(fd);
+		return -1;
+	}
+	size_t written = 0;
+	while (written < buffer.size()) {
+		ssize_t ret = write(fd, buffer.data() + written, buffer.size() - written);
+		if (ret < 0) {
+			perror("write symbol cache");
+			flock(fd, LOCK_UN);
+			close(fd);
+			return -1;
+		}
+		written += ret;
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	return records;
+}
@@ -0,0 +1,46 @@
+#ifndef __SYMBOLCACHE_H__
+#define __SYMBOLCACHE_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include "binaryread.h"
+
+#define SYMBOL_CACHE_MAGIC		"LDSYMC1\n"			// Starts a cache file, followed by the length of the key, and the key
+
+/**
+ * Persists resolved instruction pointers across runs, because many traces are converted against the same vmlinux.
+ * The file starts with a key, which consists of the ELF build-id of the vmlinux, the compilation directory
+ * the file names are relative to, and the resolver which has produced the records. It is followed by one record per instruction pointer:
+ * the address, the number of locations, and each location as line, function name and file name.
+ * New records are appended at the end of a run. A file with another key, or with a torn record
+ * at its end, is rewritten as a whole instead. Runs in parallel serialize by flock().
+ */
+struct SymbolCache {
+	SymbolCache() : m_enabled(false), m_rewrite(true) { }
+	/**
+	 * Reads the records of {@param cacheName} into {@param resolved} if its key matches {@param buildId}, {@param compDir},
+	 * and {@param resolver}.
+	 * Returns the number of records read.
+	 */
+	size_t load(const char *cacheName, const std::string &buildId, const char *compDir, const char *resolver, std::map<uint64_t, ResolvedInstructionPtr> &resolved);
+	/**
+	 * Writes the entries of {@param resolved}, which have not been loaded, to the cache file.
+	 * Returns the number of records written, or -1 on error.
+	 */
+	long save(const std::map<uint64_t, ResolvedInstructionPtr> &resolved);
+
+	private:
+	bool m_enabled;												// load() has been called
+	bool m_rewrite;												// The file has to be written from scratch
+	std::string m_name;
+	std::string m_key;
+	std::vector<uint64_t> m_loaded;								// Sorted addresses of the records read
+	std::unordered_set<std::string> m_strings;					// Names of the records read
+
+	const char* intern(const char *str, size_t length);
+};
+
+#endif // __SYMBOLCACHE_H__
@@ -0,0 +1,42 @@
+#include "symboltable.h"
+
+using namespace std;
+
+SymbolTable symbols;
+
+void SymbolTable::setKernelDir(const char *kernelDir) {
+	m_kernelDir = kernelDir;
+	if (m_kernelDir.empty() || m_kernelDir.back() != '/') {
+		m_kernelDir.append("/");
+	}
+	m_files.clear();
+}
+
+SymbolID SymbolTable::intern(string_view str) {
+	auto it = m_ids.find(str);
+	if (it != m_ids.end()) {
+		return it->second;
+	}
+	SymbolID id = m_strings.size();
+	const string &stored = m_storage.emplace_back(str);
+	m_strings.push_back(&stored);
+	m_ids.emplace(stored, id);
+	return id;
+}
+
+SymbolID SymbolTable::internFile(string_view file) {
+	auto it = m_files.find(file);
+	if (it != m_files.end()) {
+		return it->second;
+	}
+	SymbolID id;
+	// The tree is cut off by its length, wherever it occurs within the file name.
+	if (file.find(m_kernelDir) != string_view::npos) {
+		id = intern(file.substr(m_kernelDir.length()));
+	} else {
+		id = intern(file);
+	}
+	const string &stored = m_storage.emplace_back(file);
+	m_files.emplace(stored, id);
+	return id;
+}
@@ -0,0 +1,55 @@
+#ifndef __SYMBOLTABLE_H__
+#define __SYMBOLTABLE_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * A small integer standing for an interned string, e.g., a lock type, a lock member, or a file name.
+ */
+typedef uint32_t SymbolID;
+
+/**
+ * Maps the strings of the trace which only take a few distinct values to small integer IDs,
+ * so that each of them is stored once, and can be passed around and compared cheaply.
+ * The table only grows. A string retrieved by get() stays valid until the program exits.
+ * It is meant to be used by a single thread, i.e., the one processing the events.
+ */
+struct SymbolTable {
+	SymbolTable() : m_kernelDir("/") { }
+	/**
+	 * Files are interned relative to {@param kernelDir}, the root of the kernel source tree.
+	 * Must be called before interning the first file.
+	 */
+	void setKernelDir(const char *kernelDir);
+	/**
+	 * Returns the ID of {@param str}, and interns it if it has not been seen yet.
+	 */
+	SymbolID intern(std::string_view str);
+	/**
+	 * Returns the ID of the file name {@param file} with the kernel source tree stripped off.
+	 * The prefix is only stripped once per distinct file.
+	 */
+	SymbolID internFile(std::string_view file);
+	const std::string& get(SymbolID id) const {
+		return *m_strings[id];
+	}
+
+	private:
+	std::string m_kernelDir;									// The kernel source tree including a trailing slash
+	std::deque<std::string> m_storage;							// The interned strings. A deque never moves its elements.
+	std::vector<const std::string*> m_strings;					// Interned strings indexed by their IDs
+	std::unordered_map<std::string_view, SymbolID> m_ids;		// Views into m_storage
+	std::unordered_map<std::string_view, SymbolID> m_files;		// Unstripped file names, views into m_storage
+};
+
+/**
+ * The process-wide symbol table
+ */
+extern SymbolTable symbols;
+
+#endif // __SYMBOLTABLE_H__
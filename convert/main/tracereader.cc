@@ -0,0 +1,279 @@
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "lockdoc_event.h"
+#include "tracereader.h"
+#include "decompressreader.h"
+#include "gzstream/gzstream.h"
+
+using namespace std;
+
+MmapTraceReader::~MmapTraceReader() {
+	if (m_base != nullptr) {
+		munmap((void*)m_base, m_size);
+	}
+}
+
+bool MmapTraceReader::open(const char *fname) {
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = ::open(fname, O_RDONLY);
+	if (fd < 0) {
+		perror("MmapTraceReader::open()->open");
+		return false;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("MmapTraceReader::open()->fstat");
+		close(fd);
+		return false;
+	}
+	// Pipes, FIFOs, and character devices cannot be mapped. The caller has to fall back to a stream.
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid after closing the file descriptor.
+	close(fd);
+	if (addr == MAP_FAILED) {
+		perror("MmapTraceReader::open()->mmap");
+		return false;
+	}
+	// The trace is read exactly once from front to back
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+	m_base = (const char*)addr;
+	m_size = st.st_size;
+	m_pos = 0;
+	return true;
+}
+
+bool MmapTraceReader::nextLine(string_view &line) {
+	const char *start, *end;
+
+	if (m_pos >= m_size) {
+		return false;
+	}
+	start = m_base + m_pos;
+	end = (const char*)memchr(start, '\n', m_size - m_pos);
+	if (end == NULL) {
+		// Last line without a trailing newline
+		end = m_base + m_size;
+	}
+	line = string_view(start, end - start);
+	m_pos = (end - m_base) + 1;
+	return true;
+}
+
+size_t MmapTraceReader::read(void *buf, size_t len) {
+	if (len > m_size - m_pos) {
+		len = m_size - m_pos;
+	}
+	memcpy(buf, m_base + m_pos, len);
+	m_pos += len;
+	return len;
+}
+
+StreamTraceReader::StreamTraceReader(igzstream *in) : m_in(in), m_gzIn(in), m_failed(false) {
+}
+
+void StreamTraceReader::checkEnd() {
+	if (m_gzIn && m_gzIn->read_failed() && !m_failed) {
+		cerr << "Cannot decompress gzip'ed trace: " << m_gzIn->read_error() << endl;
+		m_failed = true;
+	}
+}
+
+/**
+ * Read up to {@param len} bytes from {@param fd} into {@param buf}, unless the end of the file is reached.
+ * Unlike a regular file, a pipe may deliver fewer bytes at once.
+ * Returns the number of bytes read, or -1 on error.
+ */
+static ssize_t readFully(int fd, unsigned char *buf, size_t len) {
+	size_t done = 0;
+	ssize_t bytes;
+
+	while (done < len) {
+		bytes = ::read(fd, buf + done, len - done);
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		} else if (bytes < 0) {
+			return -1;
+		} else if (bytes == 0) {
+			break;
+		}
+		done += bytes;
+	}
+	return done;
+}
+
+TraceReader* openTraceReader(const char *fname, unsigned threads) {
+	unsigned char magic[4];
+	struct stat st;
+	ssize_t bytes;
+	int fd;
+
+	if (strcmp(fname, "-") == 0) {
+		fd = dup(STDIN_FILENO);
+	} else {
+		fd = open(fname, O_RDONLY);
+	}
+	if (fd < 0) {
+		perror("openTraceReader()->open");
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("openTraceReader()->fstat");
+		close(fd);
+		return NULL;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		// Pipes, FIFOs, and stdin cannot be reopened. Hence, the bytes sniffed
+		// to detect the compression are handed over to the reader.
+		bytes = readFully(fd, magic, sizeof(magic));
+		if (bytes < 0) {
+			perror("openTraceReader()->read");
+			close(fd);
+			return NULL;
+		}
+		return new PipeTraceReader(fd, detectCompression(magic, bytes), magic, bytes);
+	}
+
+	// A regular file can be reopened by the respective reader
+	bytes = pread(fd, magic, sizeof(magic), 0);
+	close(fd);
+	if (bytes < 0) {
+		perror("openTraceReader()->pread");
+		return NULL;
+	} else if (bytes < 2) {
+		return NULL;
+	}
+	enum COMPRESSION compression = detectCompression(magic, bytes);
+	if (compression == COMPRESSION_GZIP) {
+		igzstream *gzinfile = new igzstream(fname);
+		if (!gzinfile->is_open()) {
+			delete gzinfile;
+			return NULL;
+		}
+		return new StreamTraceReader(gzinfile);
+	} else if (compression == COMPRESSION_ZSTD || compression == COMPRESSION_LZ4) {
+		DecompressTraceReader *decompressReader = new DecompressTraceReader(compression, threads);
+		if (!decompressReader->open(fname)) {
+			delete decompressReader;
+			return NULL;
+		}
+		return decompressReader;
+	}
+	// Uncompressed regular files are mapped into memory, and tokenized in place.
+	MmapTraceReader *mmapReader = new MmapTraceReader();
+	if (!mmapReader->open(fname)) {
+		delete mmapReader;
+		return NULL;
+	}
+	return mmapReader;
+}
+
+bool parseCSVEvent(string_view line, char delimiter, bool ctxTracing, TraceEvent &event, ostream &err) {
+	string_view elems[MAX_COLUMNS];
+	size_t elemCount;
+
+	// Tokenize each line by delimiter. The columns point into the input buffer, nothing is copied.
+	elemCount = splitLine(line, delimiter, elems, MAX_COLUMNS);
+
+	// Parse each element
+	event.ts = parseNumber<unsigned long long>(elems[0], 10, "stoull");
+	if (elemCount != MAX_COLUMNS) {
+		err << "Line (ts=" << event.ts << ") contains " << elemCount << " elements. Expected " << MAX_COLUMNS << "." << endl;
+		return false;
+	}
+	event.reset();
+	try {
+		if (elems[1].empty()) {
+			throw out_of_range("action");
+		}
+		event.action = elems[1][0];
+		event.assigned |= TRACE_EVENT_ACTION;
+		switch (event.action) {
+		case LOCKDOC_ALLOC:
+		case LOCKDOC_FREE:
+			{
+				event.type = elems[6];
+				event.address = parseNumber<unsigned long long>(elems[3], 16, "stoull");
+				event.size = parseNumber<unsigned long long>(elems[4], 10, "stoull");
+				break;
+			}
+		case LOCKDOC_LOCK_OP:
+			{
+				int temp;
+				event.address = parseNumber<unsigned long long>(elems[3], 16, "stoull");
+				event.lockMember = elems[7];
+				event.file = elems[8];
+				event.line = parseNumber<unsigned long long>(elems[9], 10, "stoull");
+				event.type = elems[6];
+				event.flags = parseNumber<int>(elems[12], 10, "stoi");
+				if (ctxTracing) {
+					event.ctx = parseNumber<long>(elems[13], 10, "stoul");
+				} else {
+					event.ctx = DUMMY_EXECUTION_CONTEXT;
+				}
+				event.assigned |= TRACE_EVENT_CTX;
+				temp = parseNumber<int>(elems[2], 10, "stoi");
+				switch (temp) {
+				case P_READ:
+				case P_WRITE:
+				case V_READ:
+				case V_WRITE:
+					event.lockOP = (enum LOCK_OP)temp;
+					event.assigned |= TRACE_EVENT_LOCK_OP;
+					break;
+				default:
+					err << "Line (ts=" << event.ts << ") contains invalid value for lock_op" << endl;
+					return false;
+				}
+				break;
+			}
+		case LOCKDOC_READ:
+		case LOCKDOC_WRITE:
+			{
+				event.address = parseNumber<unsigned long long>(elems[3], 16, "stoull");
+				event.size = parseNumber<unsigned long long>(elems[4], 10, "stoull");
+				event.baseAddress = parseNumber<unsigned long long>(elems[5], 16, "stoull");
+				event.instrPtr = parseNumber<unsigned long long>(elems[10], 16, "stoull");
+				event.stacktrace = elems[11];
+				event.ctx = parseNumber<long>(elems[13], 10, "stoul");
+				event.assigned |= TRACE_EVENT_CTX;
+				break;
+			}
+		}
+	} catch (exception &e) {
+		err << "Exception occurred (ts="<< event.ts << "): " << e.what() << endl;
+	}
+	return true;
+}
+
+size_t splitLine(string_view line, char delimiter, string_view *elems, size_t maxElems) {
+	size_t count = 0, start = 0, pos;
+
+	while (start < line.size()) {
+		pos = line.find(delimiter, start);
+		if (pos == string_view::npos) {
+			pos = line.size();
+		}
+		if (count < maxElems) {
+			elems[count] = line.substr(start, pos - start);
+		}
+		count++;
+		start = pos + 1;
+	}
+	return count;
+}
@@ -0,0 +1,214 @@
+#ifndef __TRACEREADER_H__
+#define __TRACEREADER_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <istream>
+#include <memory>
+#include <charconv>
+#include <stdexcept>
+#include "lockdoc_event.h"
+
+class igzstream;
+
+/**
+ * Delivers the input trace line by line, or as raw bytes.
+ * A line handed out by nextLine() is only valid until the next call.
+ */
+struct TraceReader {
+	virtual ~TraceReader() {}
+	/**
+	 * Stores the next line (without the trailing newline) in {@param line}.
+	 * Returns false if the end of the trace has been reached.
+	 */
+	virtual bool nextLine(std::string_view &line) = 0;
+	/**
+	 * Copies the next {@param len} bytes to {@param buf}.
+	 * Returns the number of bytes actually read, which is less than {@param len} at the end of the trace.
+	 */
+	virtual size_t read(void *buf, size_t len) = 0;
+	/**
+	 * Returns the next byte without consuming it, or EOF.
+	 */
+	virtual int peek() = 0;
+	/**
+	 * Tells whether the trace has ended early, because it could not be read or decompressed.
+	 * The error has already been reported then.
+	 */
+	virtual bool failed() const {
+		return false;
+	}
+};
+
+/**
+ * Reads an uncompressed trace which resides in a regular file.
+ * The whole file is mapped into memory, and each line is handed out
+ * as a view into the mapping. Hence, the trace data is never copied.
+ */
+struct MmapTraceReader : public TraceReader {
+	MmapTraceReader() : m_base(nullptr), m_size(0), m_pos(0) { }
+	~MmapTraceReader();
+	/**
+	 * Map {@param fname} into memory.
+	 * Returns false if the file is not a regular file, e.g., a pipe, or cannot be mapped.
+	 */
+	bool open(const char *fname);
+	bool nextLine(std::string_view &line);
+	size_t read(void *buf, size_t len);
+	int peek() {
+		return m_pos < m_size ? (unsigned char)m_base[m_pos] : EOF;
+	}
+	/**
+	 * The whole mapping, e.g., for decoding it in place.
+	 */
+	const char* data() const {
+		return m_base;
+	}
+	size_t size() const {
+		return m_size;
+	}
+
+	private:
+	const char *m_base;											// Start of the mapping
+	size_t m_size;												// Size of the mapping in bytes
+	size_t m_pos;												// Offset of the next line
+};
+
+/**
+ * Reads the trace from an arbitrary istream, e.g., an igzstream or a pipe.
+ */
+struct StreamTraceReader : public TraceReader {
+	/**
+	 * The reader takes the ownership of {@param in}.
+	 */
+	StreamTraceReader(std::istream *in) : m_in(in), m_gzIn(NULL), m_failed(false) { }
+	/**
+	 * Like above, but an igzstream also tells whether the trace is corrupt or truncated.
+	 */
+	StreamTraceReader(igzstream *in);
+	bool nextLine(std::string_view &line) {
+		if (!getline(*m_in, m_line)) {
+			checkEnd();
+			return false;
+		}
+		line = m_line;
+		return true;
+	}
+	size_t read(void *buf, size_t len) {
+		m_in->read((char*)buf, len);
+		if ((size_t)m_in->gcount() < len) {
+			checkEnd();
+		}
+		return m_in->gcount();
+	}
+	int peek() {
+		return m_in->peek();
+	}
+	bool failed() const {
+		return m_failed;
+	}
+
+	private:
+	std::unique_ptr<std::istream> m_in;
+	igzstream *m_gzIn;											// m_in, if it is an igzstream
+	bool m_failed;
+	std::string m_line;											// Buffer for the current line, reused for every line
+
+	/**
+	 * Sets, and reports, m_failed once the end of an igzstream has been reached due to an error.
+	 */
+	void checkEnd();
+};
+
+/**
+ * Opens the trace {@param fname}, and chooses the appropriate reader:
+ * gzip'ed traces are decompressed on the fly, zstd and lz4 traces are decompressed by {@param threads} workers
+ * (0: one per CPU), and uncompressed regular files are mapped into memory.
+ * Pipes and FIFOs, as well as stdin if {@param fname} is "-", are read as a stream, which may be compressed as well.
+ * Returns NULL if the file cannot be opened.
+ */
+TraceReader* openTraceReader(const char *fname, unsigned threads = 0);
+
+/**
+ * A single event of the input trace.
+ * Only the members belonging to the respective action are valid. All others keep their dummy values.
+ * The strings point into the buffer of the reader, and are only valid until the next event is read.
+ */
+struct TraceEvent {
+	unsigned long long ts;										// Timestamp
+	char action;												// enum LOCKDOC_OP
+	enum LOCK_OP lockOP;										// Lock operation of a LOCKDOC_LOCK_OP
+	unsigned long long address;									// Accessed address, lock address, or base address of an allocation
+	unsigned long long size;									// Size of the memory access or the allocation
+	unsigned long long baseAddress;								// Base address of the allocation a memory access belongs to
+	std::string_view type;										// Data type of an allocation, or the lock type
+	std::string_view lockMember;								// Member name of the lock
+	std::string_view file;										// File where the lock operation has happened
+	unsigned long long line;									// Line within that file
+	unsigned long long instrPtr;								// Instruction pointer of the memory access
+	std::string_view stacktrace;								// Comma-separated list of return addresses of the memory access
+	int flags;													// Lock flags
+	long ctx;													// Execution context
+	unsigned char assigned;										// Which of action, lockOP and ctx have been assigned by the parser (TRACE_EVENT_*)
+
+	TraceEvent() : ts(0), action('.'), lockOP(P_WRITE), ctx(0) {
+		reset();
+	}
+
+	/**
+	 * Reset every member that depends on the action to its dummy value.
+	 * The action, the lock operation and the context keep their values from the previous event.
+	 */
+	void reset() {
+		address = 0x1337, size = 4711, line = 1337, baseAddress = 0x4711, instrPtr = 0xc0ffee, flags = 0x4712;
+		type = file = stacktrace = "empty";
+		lockMember = "";
+		assigned = 0;
+	}
+};
+
+#define TRACE_EVENT_ACTION		0x1
+#define TRACE_EVENT_LOCK_OP		0x2
+#define TRACE_EVENT_CTX			0x4
+#define TRACE_EVENT_ALL			(TRACE_EVENT_ACTION | TRACE_EVENT_LOCK_OP | TRACE_EVENT_CTX)
+
+/**
+ * Parse the CSV {@param line} of the input trace into {@param event}.
+ * If {@param ctxTracing} is false, the context of lock operations is not parsed.
+ * Malformed columns are reported to {@param err}, and the event is left partially filled.
+ * Returns false if the line cannot be processed at all. In this case, an error message has already been printed.
+ */
+bool parseCSVEvent(std::string_view line, char delimiter, bool ctxTracing, TraceEvent &event, std::ostream &err);
+
+/**
+ * Tokenize {@param line} by {@param delimiter}, and store at most {@param maxElems} columns in {@param elems}.
+ * Like getline(), an empty column at the end of a line is not counted.
+ * Returns the number of columns in {@param line}, which may exceed {@param maxElems}.
+ */
+size_t splitLine(std::string_view line, char delimiter, std::string_view *elems, size_t maxElems);
+
+/**
+ * Parse the number in {@param str} without copying it.
+ * Hexadecimal numbers may carry a 0x prefix.
+ * On error, the same exceptions as std::sto*() are thrown, using {@param what} as message.
+ */
+template <typename T>
+static inline T parseNumber(std::string_view str, int base, const char *what)
+{
+	T ret = 0;
+	const char *first = str.data(), *last = str.data() + str.size();
+
+	if (base == 16 && str.size() > 2 && first[0] == '0' && (first[1] == 'x' || first[1] == 'X')) {
+		first += 2;
+	}
+	auto result = std::from_chars(first, last, ret, base);
+	if (result.ec == std::errc::invalid_argument) {
+		throw std::invalid_argument(what);
+	} else if (result.ec == std::errc::result_out_of_range) {
+		throw std::out_of_range(what);
+	}
+	return ret;
+}
+
+#endif // __TRACEREADER_H__
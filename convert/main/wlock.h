@@ -4,7 +4,7 @@
 #include "rwlock.h"
 
 struct WLock : public RWLock {
-	WLock (unsigned long long _lockAddress, unsigned _allocID, std::string _lockType, const char *_lockVarName, unsigned _flags, LockManager *_lockManager) : RWLock(_lockAddress, _allocID, _lockType, _lockVarName, _flags, _lockManager) {
+	WLock (unsigned long long _lockAddress, unsigned _allocID, SymbolID _lockType, const char *_lockVarName, unsigned _flags, LockManager *_lockManager) : RWLock(_lockAddress, _allocID, _lockType, _lockVarName, _flags, _lockManager) {
 			
 	}
 
@@ -28,20 +28,19 @@ struct WLock : public RWLock {
 		throw invalid_argument("ID for reader sub lock requested.");
 	}
 
-	virtual void writeLock(std::ofstream &oFile, char delimiter) {
-		this->writeWriterLock(oFile, delimiter);
+	virtual void writeLock(CSVWriter &oFile) {
+		this->writeWriterLock(oFile);
 	}
 
 	void transition(
 	enum LOCK_OP lockOP,
 	unsigned long long ts,
-	std::string const& file,
+	SymbolID file,
 	unsigned long long line,
-	string const& lockMember,
+	SymbolID lockMember,
 	unsigned flags,
-	const char *kernelDir,
 	long ctx) {
-		RWLock::writeTransition(lockOP, ts, file, line, lockMember, flags, kernelDir, ctx);
+		RWLock::writeTransition(lockOP, ts, file, line, lockMember, flags, ctx);
 	}
 };
 
@@ -0,0 +1,17 @@
+-- Variant of db-scheme.sql for traces converted with convert -l.
+-- Apply it after db-scheme.sql. Instead of one locks_held row per lock and TXN,
+-- each TXN refers to the set of locks held during it, and each distinct set is stored once.
+-- The former locks_held(txn_id, lock_id) corresponds to:
+--   SELECT t.id AS txn_id, ls.lock_id FROM txns t JOIN locksets ls ON ls.id = t.lockset_id
+-- locks_held is only filled if convert additionally ran with -p.
+
+CREATE TABLE locksets (			-- Each distinct set of locks held during a TXN. There is one entry per lock in a set.
+  id int CHECK (id > 0) NOT NULL,		-- Identifies a particular set of locks
+  lock_id int CHECK (lock_id > 0) NOT NULL,		-- References a lock which is part of the set
+  PRIMARY KEY (id,lock_id)
+)
+;
+
+ALTER TABLE txns ADD COLUMN lockset_id int DEFAULT NULL;	-- References the set of locks held during this TXN (NULL if none)
+
+CREATE INDEX fk_lockset_id ON txns (lockset_id);